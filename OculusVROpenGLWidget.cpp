@@ -7,12 +7,28 @@
 #include <QMessageBox>
 #include <QApplication>
 #include <QDebug>
+#include <QOpenGLContext>
+#include <QStandardPaths>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <cstddef>
 
 #if defined(_WIN32)
 #include <dxgi.h> // for GetDefaultAdapterLuid
 #pragma comment(lib, "dxgi.lib")
 #endif
 
+// SIMD width of the camera rig
+#if defined(__AVX__)
+#include <immintrin.h>
+#define OVR_CAMERA_RIG_AVX
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define OVR_CAMERA_RIG_SSE
+#endif
+
 
 
 
@@ -29,13 +45,42 @@ OculusVROpenGLWidget::OculusVROpenGLWidget(
 	m_showInWidget(showInWidget),
 	m_frameIndex(0),
 	m_parentWidget(parent),
-	m_enableControllers(enableControllers)
+	m_enableControllers(enableControllers),
+	m_programCache(nullptr),
+	m_initializationTime(0.0),
+	m_previewMode(PreviewRender),
+	m_customSpectator(false),
+	m_reprojectionVao(0),
+	m_framesInFlight(2),
+	m_frameAllocatorSize(OVR_FRAME_ALLOCATOR_SIZE),
+	m_currentFrame(nullptr),
+	m_frameBuffer(0),
+	m_frameBufferData(nullptr),
+	m_occlusionCuller(nullptr)
 #ifdef	MIRRORING_WITH_FBO
 	,m_mirrorTexture(nullptr),
 	m_mirrorFBO(0),
 	m_mirrorTexId(0)
 #endif
 {
+	m_eyeRenderTexture[0] = m_eyeRenderTexture[1] = nullptr;
+	m_reprojectionPrograms[0] = m_reprojectionPrograms[1] = 0;
+	for (int i = 0; i < OVR_MAX_FRAMES_IN_FLIGHT; ++i)
+		m_frames[i].fence = nullptr;
+	m_frameStatistics.frames = 0;
+	m_frameStatistics.stallsAvoided = 0;
+	m_frameStatistics.stalls = 0;
+	m_frameStatistics.stallTime = 0.0;
+
+	m_memoryTracker.SetBudgetCallback([this](qint64 usage, qint64 budget) {
+		emit signalMemoryBudgetWarning(usage, budget);
+	});
+
+	// Views 0 and 1 are the eyes
+	m_cameraRig.AddView();
+	m_cameraRig.AddView();
+	m_spectatorRigView = m_cameraRig.AddView();
+
 	InitializeOculusVR();
 	resize(m_hmdDesc.Resolution.w, m_hmdDesc.Resolution.h);
 
@@ -48,17 +93,61 @@ OculusVROpenGLWidget::OculusVROpenGLWidget(
 OculusVROpenGLWidget::~OculusVROpenGLWidget()
 {
 	m_timer.stop();
+
+	// The context is destroyed after this destructor: release its objects now
+	if (context())
+		disconnect(context(), SIGNAL(aboutToBeDestroyed()), this, SLOT(ReleaseContext()));
+	ReleaseContext();
+
+	if ( m_session ) ovr_Destroy(m_session);
+	ovr_Shutdown();
+}
+
+
+void OculusVROpenGLWidget::ReleaseContext()
+{
+	makeCurrent();
+
 #ifdef	MIRRORING_WITH_FBO
 	if (m_mirrorFBO) glDeleteFramebuffers(1, &m_mirrorFBO);
 	if (m_mirrorTexture) ovr_DestroyMirrorTexture(m_session, m_mirrorTexture);
 	if (m_mirrorTexId) glDeleteTextures(1, &m_mirrorTexId);
+	m_mirrorFBO = 0;
+	m_mirrorTexture = nullptr;
+	m_mirrorTexId = 0;
 #endif
 	for (int eye = 0; eye < 2; ++eye)
 	{
 		delete m_eyeRenderTexture[eye];
+		m_eyeRenderTexture[eye] = nullptr;
 	}
-	if ( m_session ) ovr_Destroy(m_session);
-	ovr_Shutdown();
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		if (m_reprojectionPrograms[pass]) glDeleteProgram(m_reprojectionPrograms[pass]);
+		m_reprojectionPrograms[pass] = 0;
+	}
+	if (m_reprojectionVao) glDeleteVertexArrays(1, &m_reprojectionVao);
+	m_reprojectionVao = 0;
+	for (int i = 0; i < OVR_MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		if (m_frames[i].fence) glDeleteSync(m_frames[i].fence);
+		m_frames[i].fence = nullptr;
+		m_frames[i].allocator.Reset(0, 0, 0, nullptr);
+	}
+	if (m_frameBuffer)
+	{
+		m_memoryTracker.Untrack(OVRMemoryTracker::Buffers, m_frameBuffer);
+		glUnmapNamedBuffer(m_frameBuffer);
+		glDeleteBuffers(1, &m_frameBuffer);
+		m_frameBuffer = 0;
+		m_frameBufferData = nullptr;
+	}
+	delete m_occlusionCuller;
+	m_occlusionCuller = nullptr;
+	delete m_programCache;
+	m_programCache = nullptr;
+
+	doneCurrent();
 }
 
 
@@ -137,8 +226,14 @@ ovrGraphicsLuid OculusVROpenGLWidget::GetDefaultAdapterLuid()
 
 void OculusVROpenGLWidget::initializeGL()
 {
+	QElapsedTimer initializationTimer;
+	initializationTimer.start();
+
 	initializeOpenGLFunctions();
 
+	// The context is destroyed when the widget is reparented or destroyed
+	connect(context(), SIGNAL(aboutToBeDestroyed()), this, SLOT(ReleaseContext()));
+
 	glEnable(GL_CULL_FACE);
 	glEnable(GL_DEPTH_TEST);
 
@@ -146,7 +241,7 @@ void OculusVROpenGLWidget::initializeGL()
 	for (int eye = 0; eye < 2; ++eye)
 	{
 		ovrSizei idealTextureSize = ovr_GetFovTextureSize(m_session, ovrEyeType(eye), m_hmdDesc.DefaultEyeFov[eye], 1);
-		m_eyeRenderTexture[eye] = new OVRTexBuffer(m_session, idealTextureSize, 1);
+		m_eyeRenderTexture[eye] = new OVRTexBuffer(m_session, idealTextureSize, 1, &m_memoryTracker);
 
 		if (!m_eyeRenderTexture[eye]->m_colorTexChain || !m_eyeRenderTexture[eye]->m_depthTexChain)
 		{
@@ -165,7 +260,20 @@ void OculusVROpenGLWidget::initializeGL()
 	// FloorLevel will give tracking poses where the floor height is 0
 	ovr_SetTrackingOriginType(m_session, ovrTrackingOrigin_FloorLevel);
 
-	InitializeRendering();	
+	// Programs binaries are stored on disk: they survive the widget recreation
+	m_programCache = new OVRProgramCache(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/programs");
+
+	InitializeReprojection();
+	InitializeFrames();
+
+	m_occlusionCuller = new OVROcclusionCuller(m_programCache, &m_memoryTracker);
+
+	InitializeRendering();
+
+	// Cache misses were compiled in parallel: wait for the last ones
+	m_programCache->Finish();
+
+	m_initializationTime = initializationTimer.nsecsElapsed() / 1000000.0;
 }
 
 
@@ -180,13 +288,19 @@ ovrSession OculusVROpenGLWidget::Session()
 	return m_session;
 }
 
+OculusVROpenGLWidget::OVRProgramCache* OculusVROpenGLWidget::ProgramCache()
+{
+	return m_programCache;
+}
+
+double OculusVROpenGLWidget::GetInitializationTime() const
+{
+	return m_initializationTime;
+}
+
 void OculusVROpenGLWidget::TranslateEyes(float i_deltaX, float i_deltaY, float i_deltaZ)
 {
-	Matrix4f rollPitchYaw =
-		Matrix4f::RotationZ(m_eyesRotations[_ROLL]) *
-		Matrix4f::RotationX(m_eyesRotations[_PITCH]) *
-		Matrix4f::RotationY(m_eyesRotations[_YAW]);
-	m_eyesTranslation += rollPitchYaw.Transform(Vector3f(i_deltaX, i_deltaY, i_deltaZ));
+	m_eyesTranslation += m_eyesRollPitchYaw.Transform(Vector3f(i_deltaX, i_deltaY, i_deltaZ));
 }
 
 void OculusVROpenGLWidget::ResetEyesPositions()
@@ -202,11 +316,16 @@ Vector3f OculusVROpenGLWidget:: GetTranslations()
 void OculusVROpenGLWidget::RotateEyes(float i_yaw, float i_pitch, float i_roll)
 {
 	m_eyesRotations += Vector3f(i_yaw, i_pitch, i_roll);
+	m_eyesRollPitchYaw =
+		Matrix4f::RotationZ(m_eyesRotations[_ROLL]) *
+		Matrix4f::RotationX(m_eyesRotations[_PITCH]) *
+		Matrix4f::RotationY(m_eyesRotations[_YAW]);
 }
 
 void OculusVROpenGLWidget::ResetEyesRotaions()
 {
 	m_eyesRotations = Vector3f();
+	m_eyesRollPitchYaw = Matrix4f();
 }
 
 Vector3f OculusVROpenGLWidget::GetRotations()
@@ -214,6 +333,91 @@ Vector3f OculusVROpenGLWidget::GetRotations()
 	return m_eyesRotations;
 }
 
+void OculusVROpenGLWidget::SetPreviewMode(PreviewMode i_mode)
+{
+	m_previewMode = i_mode;
+}
+
+OculusVROpenGLWidget::PreviewMode OculusVROpenGLWidget::GetPreviewMode() const
+{
+	return m_previewMode;
+}
+
+void OculusVROpenGLWidget::SetSpectatorCamera(const Matrix4f& i_view, const Matrix4f& i_projection)
+{
+	m_spectatorView = i_view;
+	m_spectatorProjection = i_projection;
+	m_customSpectator = true;
+}
+
+void OculusVROpenGLWidget::ResetSpectatorCamera()
+{
+	m_customSpectator = false;
+}
+
+void OculusVROpenGLWidget::SetFramesInFlight(int i_count, GLsizeiptr i_allocatorSize)
+{
+	// The current frame allocator lives in the frames buffer
+	if (m_currentFrame)
+	{
+		qDebug() << "SetFramesInFlight cannot be called during a frame.";
+		return;
+	}
+
+	m_framesInFlight = qBound(1, i_count, OVR_MAX_FRAMES_IN_FLIGHT);
+	m_frameAllocatorSize = i_allocatorSize;
+
+	// Once initialized, the frames buffer is sized for the previous settings
+	if (m_frameBuffer)
+	{
+		bool current = (QOpenGLContext::currentContext() == context());
+		if (!current)
+			makeCurrent();
+		InitializeFrames();
+		if (!current)
+			doneCurrent();
+	}
+}
+
+OculusVROpenGLWidget::FrameStatistics OculusVROpenGLWidget::GetFrameStatistics() const
+{
+	return m_frameStatistics;
+}
+
+OculusVROpenGLWidget::OVROcclusionCuller* OculusVROpenGLWidget::OcclusionCuller()
+{
+	return m_occlusionCuller;
+}
+
+OculusVROpenGLWidget::OVRCameraRig* OculusVROpenGLWidget::CameraRig()
+{
+	return &m_cameraRig;
+}
+
+OculusVROpenGLWidget::OVRMemoryTracker* OculusVROpenGLWidget::MemoryTracker()
+{
+	return &m_memoryTracker;
+}
+
+void OculusVROpenGLWidget::SetMemoryBudget(qint64 i_bytes, double i_warningRatio)
+{
+	m_memoryTracker.SetBudget(i_bytes, i_warningRatio);
+}
+
+bool OculusVROpenGLWidget::IsObjectVisible(ovrEyeType eye, int object) const
+{
+	return m_occlusionCuller ? m_occlusionCuller->IsVisible(eye, object) : true;
+}
+
+void OculusVROpenGLWidget::UpdateRendering(ovrSessionStatus)
+{
+}
+
+void OculusVROpenGLWidget::UpdateFrameRendering(ovrSessionStatus sessionStatus, OVRFrameAllocator&)
+{
+	UpdateRendering(sessionStatus);
+}
+
 void OculusVROpenGLWidget::Render(ovrSessionStatus sessionStatus, TargetRendering i_target)
 {
 	// touch
@@ -239,6 +443,46 @@ void OculusVROpenGLWidget::Render(ovrSessionStatus sessionStatus, TargetRenderin
 
 	ovrTimewarpProjectionDesc posTimewarpProjectionDesc = {};
 
+	// Get view and projection matrices: the eyes, the spectator and the client views in one pass
+	Vector3f rigRotations(m_eyesRotations[_YAW] + yawOffest, m_eyesRotations[_PITCH], m_eyesRotations[_ROLL]);
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		m_cameraRig.SetRig(eye, m_eyesTranslation, rigRotations);
+		m_cameraRig.SetPose(eye, EyeRenderPose[eye].Orientation, EyeRenderPose[eye].Position);
+		m_cameraRig.SetFov(eye, m_hmdDesc.DefaultEyeFov[eye], 0.2f, 1000.0f);
+	}
+
+	if (i_target == Headset && !m_customSpectator)
+	{
+		// Between the eyes, following the eyes rotations but not the head orientation
+		Vector3f headPosition = (Vector3f(EyeRenderPose[0].Position) + Vector3f(EyeRenderPose[1].Position)) * 0.5f;
+		m_cameraRig.SetRig(m_spectatorRigView, m_eyesTranslation, rigRotations);
+		m_cameraRig.SetPose(m_spectatorRigView, Quatf(), headPosition);
+	}
+
+	m_cameraRig.Update();
+
+	Matrix4f views[2];
+	Matrix4f projs[2];
+	Vector3f eyePositions[2];
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		views[eye] = m_cameraRig.GetView(eye);
+		projs[eye] = m_cameraRig.GetProjection(eye);
+		eyePositions[eye] = m_cameraRig.GetPosition(eye);
+	}
+
+	// Visibility for both eyes, from the depth of the previous frame left eye (m_eyeViews not updated yet)
+	if (i_target == Headset && m_occlusionCuller->GetObjectCount() > 0)
+	{
+		m_occlusionCuller->Cull(
+			m_eyeRenderTexture[0]->m_lastDepthTexId,
+			m_eyeProjections[0] * m_eyeViews[0],
+			projs[0] * views[0],
+			projs[1] * views[1],
+			(eyePositions[1] - eyePositions[0]).Length());
+	}
+
 	// Render Scene to Eye Buffers
 	for (int eye = 0; eye < 2; ++eye)
 	{
@@ -259,24 +503,17 @@ void OculusVROpenGLWidget::Render(ovrSessionStatus sessionStatus, TargetRenderin
 			m_eyeRenderTexture[eye]->SetAndClearRenderSurface();
 		}
 
-		// Get view and projection matrices
-		Matrix4f rollPitchYaw = 
-			Matrix4f::RotationZ(m_eyesRotations[_ROLL]) *
-			Matrix4f::RotationX(m_eyesRotations[_PITCH]) *
-			Matrix4f::RotationY(m_eyesRotations[_YAW] + yawOffest);
-
-		Matrix4f finalRollPitchYaw = rollPitchYaw * Matrix4f(EyeRenderPose[eye].Orientation);
-		Vector3f finalUp = finalRollPitchYaw.Transform(Vector3f(0, 1, 0));
-		Vector3f finalForward = finalRollPitchYaw.Transform(Vector3f(0, 0, -1));
-		Vector3f shiftedEyePos = m_eyesTranslation + rollPitchYaw.Transform(EyeRenderPose[eye].Position);
-
-		Matrix4f view = Matrix4f::LookAtRH(shiftedEyePos, shiftedEyePos + finalForward, finalUp);
-		Matrix4f proj = ovrMatrix4f_Projection(m_hmdDesc.DefaultEyeFov[eye], 0.2f, 1000.0f, ovrProjection_None);
 		if (i_target == Headset)
-			posTimewarpProjectionDesc = ovrTimewarpProjectionDesc_FromProjection(proj, ovrProjection_None);
+		{
+			posTimewarpProjectionDesc = ovrTimewarpProjectionDesc_FromProjection(projs[eye], ovrProjection_None);
+
+			// Kept for the reprojection preview and the occlusion culling
+			m_eyeViews[eye] = views[eye];
+			m_eyeProjections[eye] = projs[eye];
+		}
 
 		// Render world
-		Render(sessionStatus, eye == 0 ? ovrEye_Left : ovrEye_Right, view, proj);
+		Render(sessionStatus, eye == 0 ? ovrEye_Left : ovrEye_Right, views[eye], projs[eye]);
 
 		if (i_target == Widget)
 			continue;
@@ -294,6 +531,9 @@ void OculusVROpenGLWidget::Render(ovrSessionStatus sessionStatus, TargetRenderin
 	if (i_target == Widget)
 		return;
 
+	if (!m_customSpectator)
+		m_spectatorView = m_cameraRig.GetView(m_spectatorRigView);
+
 	// Do distortion rendering, Present and flush/sync
 
 	ovrLayerEyeFovDepth ld = {};
@@ -355,8 +595,9 @@ void OculusVROpenGLWidget::paintGL()
 	}
 
 	if (sessionStatus.IsVisible)
-	{		
-		UpdateRendering(sessionStatus);
+	{
+		BeginFrame();
+		UpdateFrameRendering(sessionStatus, m_currentFrame->allocator);
 		Render(sessionStatus, Headset);
 	}
 
@@ -365,12 +606,107 @@ void OculusVROpenGLWidget::paintGL()
 #ifdef MIRRORING_WITH_FBO
 		RenderMirroring();
 #else
-		makeCurrent();
+		// The context is current in paintGL(): releasing it would leave the frame fence without context
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		Render(sessionStatus, Widget);
-		doneCurrent();
+		if (m_previewMode == PreviewReprojection && m_frameIndex > 0)
+			RenderReprojection();
+		else
+			Render(sessionStatus, Widget);
 #endif
 	}
+
+	// After the preview too, which may read the frame allocations
+	if (m_currentFrame)
+		EndFrame();
+}
+
+
+void OculusVROpenGLWidget::InitializeFrames()
+{
+	for (int i = 0; i < OVR_MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		if (m_frames[i].fence) glDeleteSync(m_frames[i].fence);
+		m_frames[i].fence = nullptr;
+	}
+	if (m_frameBuffer)
+	{
+		m_memoryTracker.Untrack(OVRMemoryTracker::Buffers, m_frameBuffer);
+		glUnmapNamedBuffer(m_frameBuffer);
+		glDeleteBuffers(1, &m_frameBuffer);
+	}
+
+	// One persistent mapping for all frames: each frame writes its own region.
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	GLsizeiptr size = m_frameAllocatorSize * m_framesInFlight;
+	m_memoryTracker.Reserve(size);
+	glCreateBuffers(1, &m_frameBuffer);
+	glNamedBufferStorage(m_frameBuffer, size, nullptr, flags);
+	m_memoryTracker.Track(OVRMemoryTracker::Buffers, m_frameBuffer, size);
+	m_frameBufferData = static_cast<char*>(glMapNamedBufferRange(m_frameBuffer, 0, size, flags));
+	if (!m_frameBufferData)
+		qDebug() << "Failed to map the frames buffer.";
+
+	for (int i = 0; i < m_framesInFlight; ++i)
+	{
+		char* data = m_frameBufferData ? m_frameBufferData + i * m_frameAllocatorSize : nullptr;
+		m_frames[i].allocator.Reset(m_frameBuffer, i * m_frameAllocatorSize, data ? m_frameAllocatorSize : 0, data);
+	}
+}
+
+
+void OculusVROpenGLWidget::BeginFrame()
+{
+	m_currentFrame = &m_frames[m_frameIndex % m_framesInFlight];
+	m_frameStatistics.frames++;
+
+	// A synchronous frame would wait for the previous frame: with several frames in flight,
+	// a stall is avoided when the previous frame is still running but the reused context is released
+	bool previousRunning = false;
+	if (m_framesInFlight > 1 && m_frameIndex > 0)
+	{
+		GLsync previousFence = m_frames[(m_frameIndex - 1) % m_framesInFlight].fence;
+		if (previousFence)
+		{
+			GLenum status = glClientWaitSync(previousFence, 0, 0);
+			previousRunning = (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED);
+		}
+	}
+
+	if (m_currentFrame->fence)
+	{
+		GLenum status = glClientWaitSync(m_currentFrame->fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		{
+			QElapsedTimer timer;
+			timer.start();
+
+			m_frameStatistics.stalls++;
+			do
+			{
+				status = glClientWaitSync(m_currentFrame->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+			} while (status == GL_TIMEOUT_EXPIRED);
+
+			m_frameStatistics.stallTime += timer.nsecsElapsed() / 1000000.0;
+			previousRunning = false;
+		}
+
+		glDeleteSync(m_currentFrame->fence);
+		m_currentFrame->fence = nullptr;
+	}
+
+	if (previousRunning)
+		m_frameStatistics.stallsAvoided++;
+
+	GLsizeiptr offset = (m_currentFrame - m_frames) * m_frameAllocatorSize;
+	char* data = m_frameBufferData ? m_frameBufferData + offset : nullptr;
+	m_currentFrame->allocator.Reset(m_frameBuffer, offset, data ? m_frameAllocatorSize : 0, data);
+}
+
+
+void OculusVROpenGLWidget::EndFrame()
+{
+	m_currentFrame->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	m_currentFrame = nullptr;
 }
 
 
@@ -419,6 +755,158 @@ void OculusVROpenGLWidget::RenderMirroring()
 #endif
 
 
+/// Reprojection vertex shader: a grid over the eye texture, each vertex is moved to its depth
+/// then projected to the spectator. Quads crossing a depth discontinuity are stretched over
+/// the disoccluded area and pushed back so that the other eye wins the depth test where it saw the surface.
+/// The program built with STRETCHED draws only those quads, the other one only the solid quads.
+static const char* s_reprojectionVertexShader = R"(
+uniform sampler2D u_depth;
+uniform mat4 u_eyeToSpectator;
+uniform mat4 u_eyeInverseProjection;
+uniform ivec2 u_gridSize;
+
+out vec2 v_uv;
+
+const ivec2 c_corners[6] = ivec2[](ivec2(0, 0), ivec2(1, 0), ivec2(1, 1), ivec2(0, 0), ivec2(1, 1), ivec2(0, 1));
+
+float Depth(vec2 uv)
+{
+	ivec2 size = textureSize(u_depth, 0);
+	return texelFetch(u_depth, clamp(ivec2(uv * vec2(size)), ivec2(0), size - 1), 0).r;
+}
+
+float ViewDistance(vec2 uv)
+{
+	vec4 position = u_eyeInverseProjection * vec4(uv * 2.0 - 1.0, Depth(uv) * 2.0 - 1.0, 1.0);
+	return -position.z / position.w;
+}
+
+void main()
+{
+	int quad = gl_VertexID / 6;
+	ivec2 cell = ivec2(quad % u_gridSize.x, quad / u_gridSize.x);
+	vec2 uv = vec2(cell + c_corners[gl_VertexID % 6]) / vec2(u_gridSize);
+
+	// Same flag for the 6 vertices of the quad: the depths of its own 4 corners
+	vec2 cellSize = 1.0 / vec2(u_gridSize);
+	vec2 origin = vec2(cell) * cellSize;
+	float d0 = ViewDistance(origin);
+	float d1 = ViewDistance(origin + vec2(cellSize.x, 0.0));
+	float d2 = ViewDistance(origin + vec2(0.0, cellSize.y));
+	float d3 = ViewDistance(origin + cellSize);
+	float nearest = min(min(d0, d1), min(d2, d3));
+	float farthest = max(max(d0, d1), max(d2, d3));
+	bool stretched = farthest - nearest > 0.1 * nearest;
+
+#ifdef STRETCHED
+	bool drawn = stretched;
+#else
+	bool drawn = !stretched;
+#endif
+	if (!drawn)
+	{
+		// Outside of the clip volume: the quad is drawn by the other program
+		gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+		v_uv = uv;
+		return;
+	}
+
+	v_uv = uv;
+	gl_Position = u_eyeToSpectator * vec4(uv * 2.0 - 1.0, Depth(uv) * 2.0 - 1.0, 1.0);
+}
+)";
+
+/// Reprojection fragment shader: only the stretched quads write their depth, the solid ones keep the early depth test
+static const char* s_reprojectionFragmentShader = R"(
+uniform sampler2D u_color;
+
+in vec2 v_uv;
+
+out vec4 o_color;
+
+void main()
+{
+	o_color = vec4(texture(u_color, v_uv).rgb, 1.0);
+#ifdef STRETCHED
+	gl_FragDepth = mix(gl_FragCoord.z, 1.0, 0.5);
+#endif
+}
+)";
+
+void OculusVROpenGLWidget::InitializeReprojection()
+{
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		if (m_reprojectionPrograms[pass]) glDeleteProgram(m_reprojectionPrograms[pass]);
+
+		QByteArray header = pass == 0 ? "#version 430\n" : "#version 430\n#define STRETCHED\n";
+		QMap<GLenum, QByteArray> sources;
+		sources.insert(GL_VERTEX_SHADER, header + s_reprojectionVertexShader);
+		sources.insert(GL_FRAGMENT_SHADER, header + s_reprojectionFragmentShader);
+		m_reprojectionPrograms[pass] = m_programCache->LoadProgram(sources);
+	}
+	if (m_reprojectionVao) glDeleteVertexArrays(1, &m_reprojectionVao);
+
+	glCreateVertexArrays(1, &m_reprojectionVao);
+}
+
+
+void OculusVROpenGLWidget::RenderReprojection()
+{
+	qreal ratio = devicePixelRatioF();
+	int w = int(width() * ratio);
+	int h = int(height() * ratio);
+	glViewport(0, 0, w, h);
+
+	Matrix4f spectatorProj = m_customSpectator ?
+		m_spectatorProjection :
+		Matrix4f::PerspectiveRH(3.141592f / 2.0f, float(w) / float(h > 0 ? h : 1), 0.2f, 1000.0f);
+	Matrix4f spectatorViewProj = spectatorProj * m_spectatorView;
+
+	// Faces seen from behind by the spectator must still fill the view
+	glDisable(GL_CULL_FACE);
+
+	glBindVertexArray(m_reprojectionVao);
+
+	// Solid quads, then stretched quads
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		GLuint program = m_reprojectionPrograms[pass];
+		glUseProgram(program);
+		glUniform1i(glGetUniformLocation(program, "u_color"), 0);
+		glUniform1i(glGetUniformLocation(program, "u_depth"), 1);
+
+		for (int eye = 0; eye < 2; ++eye)
+		{
+			OVRTexBuffer* texture = m_eyeRenderTexture[eye];
+			if (!texture || !texture->m_lastColorTexId || !texture->m_lastDepthTexId)
+				continue;
+
+			Matrix4f eyeToSpectator = spectatorViewProj * (m_eyeProjections[eye] * m_eyeViews[eye]).Inverted();
+			Matrix4f eyeInverseProjection = m_eyeProjections[eye].Inverted();
+			int gridWidth = (texture->m_texSize.w + OVR_REPROJECTION_GRID_STEP - 1) / OVR_REPROJECTION_GRID_STEP;
+			int gridHeight = (texture->m_texSize.h + OVR_REPROJECTION_GRID_STEP - 1) / OVR_REPROJECTION_GRID_STEP;
+
+			// Matrix4f is row major
+			glUniformMatrix4fv(glGetUniformLocation(program, "u_eyeToSpectator"), 1, GL_TRUE, &eyeToSpectator.M[0][0]);
+			glUniformMatrix4fv(glGetUniformLocation(program, "u_eyeInverseProjection"), 1, GL_TRUE, &eyeInverseProjection.M[0][0]);
+			glUniform2i(glGetUniformLocation(program, "u_gridSize"), gridWidth, gridHeight);
+
+			glBindTextureUnit(0, texture->m_lastColorTexId);
+			glBindTextureUnit(1, texture->m_lastDepthTexId);
+
+			glDrawArrays(GL_TRIANGLES, 0, 6 * gridWidth * gridHeight);
+		}
+	}
+
+	glBindTextureUnit(0, 0);
+	glBindTextureUnit(1, 0);
+	glBindVertexArray(0);
+	glUseProgram(0);
+	glEnable(GL_CULL_FACE);
+}
+
+
 
 
 
@@ -428,12 +916,15 @@ void OculusVROpenGLWidget::RenderMirroring()
 // OCULUS TEXTURES
 // 
 
-OculusVROpenGLWidget::OVRTexBuffer::OVRTexBuffer(ovrSession session, Sizei size, int sampleCount) :
+OculusVROpenGLWidget::OVRTexBuffer::OVRTexBuffer(ovrSession session, Sizei size, int sampleCount, OVRMemoryTracker* memoryTracker) :
 	m_session(session),
 	m_colorTexChain(nullptr),
 	m_depthTexChain(nullptr),
 	m_fboId(0),
-	m_texSize(0, 0)
+	m_lastColorTexId(0),
+	m_lastDepthTexId(0),
+	m_texSize(0, 0),
+	m_memoryTracker(memoryTracker)
 {
 	initializeOpenGLFunctions();
 	assert(sampleCount <= 1); // The code doesn't currently handle MSAA textures.
@@ -453,7 +944,14 @@ OculusVROpenGLWidget::OVRTexBuffer::OVRTexBuffer(ovrSession session, Sizei size,
 	desc.SampleCount = sampleCount;
 	desc.StaticImage = ovrFalse;
 
+	// The swap chains length is only known once created: the budget is checked with a usual length
+	static const int s_swapChainLength = 3;
+
 	{
+		// RGBA8 textures
+		if (m_memoryTracker)
+			m_memoryTracker->Reserve(qint64(size.w) * size.h * 4 * s_swapChainLength);
+
 		ovrResult result = ovr_CreateTextureSwapChainGL(m_session, &desc, &m_colorTexChain);
 
 		int length = 0;
@@ -461,6 +959,9 @@ OculusVROpenGLWidget::OVRTexBuffer::OVRTexBuffer(ovrSession session, Sizei size,
 
 		if (OVR_SUCCESS(result))
 		{
+			if (m_memoryTracker)
+				m_memoryTracker->Track(OVRMemoryTracker::SwapChains, reinterpret_cast<quintptr>(m_colorTexChain), qint64(size.w) * size.h * 4 * length);
+
 			for (int i = 0; i < length; ++i)
 			{
 				GLuint chainTexId;
@@ -478,6 +979,10 @@ OculusVROpenGLWidget::OVRTexBuffer::OVRTexBuffer(ovrSession session, Sizei size,
 	desc.Format = OVR_FORMAT_D32_FLOAT;
 
 	{
+		// D32 textures
+		if (m_memoryTracker)
+			m_memoryTracker->Reserve(qint64(size.w) * size.h * 4 * s_swapChainLength);
+
 		ovrResult result = ovr_CreateTextureSwapChainGL(m_session, &desc, &m_depthTexChain);
 
 		int length = 0;
@@ -485,6 +990,9 @@ OculusVROpenGLWidget::OVRTexBuffer::OVRTexBuffer(ovrSession session, Sizei size,
 
 		if (OVR_SUCCESS(result))
 		{
+			if (m_memoryTracker)
+				m_memoryTracker->Track(OVRMemoryTracker::SwapChains, reinterpret_cast<quintptr>(m_depthTexChain), qint64(size.w) * size.h * 4 * length);
+
 			for (int i = 0; i < length; ++i)
 			{
 				GLuint chainTexId;
@@ -500,22 +1008,27 @@ OculusVROpenGLWidget::OVRTexBuffer::OVRTexBuffer(ovrSession session, Sizei size,
 	}
 
 	glGenFramebuffers(1, &m_fboId);
+	if (m_memoryTracker)
+		m_memoryTracker->Track(OVRMemoryTracker::Framebuffers, m_fboId, 0);
 }
 
 OculusVROpenGLWidget::OVRTexBuffer::~OVRTexBuffer()
 {
 	if (m_colorTexChain)
 	{
+		if (m_memoryTracker) m_memoryTracker->Untrack(OVRMemoryTracker::SwapChains, reinterpret_cast<quintptr>(m_colorTexChain));
 		ovr_DestroyTextureSwapChain(m_session, m_colorTexChain);
 		m_colorTexChain = nullptr;
 	}
 	if (m_depthTexChain)
 	{
+		if (m_memoryTracker) m_memoryTracker->Untrack(OVRMemoryTracker::SwapChains, reinterpret_cast<quintptr>(m_depthTexChain));
 		ovr_DestroyTextureSwapChain(m_session, m_depthTexChain);
 		m_depthTexChain = nullptr;
 	}
 	if (m_fboId)
 	{
+		if (m_memoryTracker) m_memoryTracker->Untrack(OVRMemoryTracker::Framebuffers, m_fboId);
 		glDeleteFramebuffers(1, &m_fboId);
 		m_fboId = 0;
 	}
@@ -541,6 +1054,10 @@ void OculusVROpenGLWidget::OVRTexBuffer::SetAndClearRenderSurface()
 		ovr_GetTextureSwapChainBufferGL(m_session, m_depthTexChain, curIndex, &curDepthTexId);
 	}
 
+	// Committed at the end of the frame, then read by the reprojection preview
+	m_lastColorTexId = curColorTexId;
+	m_lastDepthTexId = curDepthTexId;
+
 	glBindFramebuffer(GL_FRAMEBUFFER, m_fboId);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, curColorTexId, 0);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, curDepthTexId, 0);
@@ -561,4 +1078,1770 @@ void OculusVROpenGLWidget::OVRTexBuffer::Commit()
 {
 	ovr_CommitTextureSwapChain(m_session, m_colorTexChain);
 	ovr_CommitTextureSwapChain(m_session, m_depthTexChain);
-};
\ No newline at end of file
+};
+
+
+
+
+
+// ////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// INDIRECT SCENE
+// 
+
+#ifndef GL_PARAMETER_BUFFER
+#define GL_PARAMETER_BUFFER 0x80EE
+#endif
+
+/// Compute shader culling the instances bounding spheres against the frustum planes.
+/// Each visible instance appends its DrawElementsIndirectCommand and increments the draw count.
+static const char* s_indirectSceneCullShader = R"(
+#version 430
+layout(local_size_x = 64) in;
+
+struct Mesh { vec4 sphere; uint indexCount; uint firstIndex; int baseVertex; uint padding; };
+struct Command { uint count; uint instanceCount; uint firstIndex; int baseVertex; uint baseInstance; };
+
+layout(std430, binding = 0) readonly buffer Instances { mat4 models[]; };
+layout(std430, binding = 1) readonly buffer InstanceMeshes { uint instanceMeshes[]; };
+layout(std430, binding = 2) readonly buffer Meshes { Mesh meshes[]; };
+layout(std430, binding = 3) writeonly buffer Commands { Command commands[]; };
+layout(std430, binding = 4) buffer Parameters { uint drawCount; };
+
+uniform vec4 u_planes[6];
+uniform uint u_instanceCount;
+
+void main()
+{
+	uint instance = gl_GlobalInvocationID.x;
+	if (instance >= u_instanceCount)
+		return;
+
+	Mesh mesh = meshes[instanceMeshes[instance]];
+	mat4 model = models[instance];
+	vec3 center = (model * vec4(mesh.sphere.xyz, 1.0)).xyz;
+	float scale = max(length(model[0].xyz), max(length(model[1].xyz), length(model[2].xyz)));
+	float radius = mesh.sphere.w * scale;
+
+	for (int i = 0; i < 6; ++i)
+	{
+		if (dot(u_planes[i].xyz, center) + u_planes[i].w < -radius)
+			return;
+	}
+
+	uint slot = atomicAdd(drawCount, 1u);
+	commands[slot] = Command(mesh.indexCount, 1u, mesh.firstIndex, mesh.baseVertex, instance);
+}
+)";
+
+OculusVROpenGLWidget::OVRIndirectScene::OVRIndirectScene(GLsizei vertexStride, GLuint instanceLocation, OVRMemoryTracker* memoryTracker) :
+	m_memoryTracker(memoryTracker),
+	m_vertexStride(vertexStride),
+	m_instanceLocation(instanceLocation),
+	m_geometryDirty(false),
+	m_instancesDirty(false),
+	m_uploadedInstances(0),
+	m_dirtyModelsBegin(0),
+	m_dirtyModelsEnd(0),
+	m_vao(0),
+	m_vertexBuffer(0),
+	m_indexBuffer(0),
+	m_meshBuffer(0),
+	m_modelBuffer(0),
+	m_instanceMeshBuffer(0),
+	m_instanceIdBuffer(0),
+	m_commandBuffer(0),
+	m_parameterBuffer(0),
+	m_cullProgram(0),
+	m_planesLocation(-1),
+	m_instanceCountLocation(-1),
+	m_multiDrawElementsIndirectCount(nullptr)
+{
+	initializeOpenGLFunctions();
+
+	// The core entry point may be exported by drivers which do not provide OpenGL 4.6
+	QOpenGLContext* context = QOpenGLContext::currentContext();
+	if (context->format().version() >= qMakePair(4, 6))
+		m_multiDrawElementsIndirectCount = reinterpret_cast<MultiDrawElementsIndirectCount>(context->getProcAddress("glMultiDrawElementsIndirectCount"));
+	if (!m_multiDrawElementsIndirectCount && context->hasExtension("GL_ARB_indirect_parameters"))
+		m_multiDrawElementsIndirectCount = reinterpret_cast<MultiDrawElementsIndirectCount>(context->getProcAddress("glMultiDrawElementsIndirectCountARB"));
+
+	glCreateVertexArrays(1, &m_vao);
+	m_parameterBuffer = CreateBuffer(sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+
+	// Cull program
+	GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(shader, 1, &s_indirectSceneCullShader, nullptr);
+	glCompileShader(shader);
+
+	GLint status = GL_FALSE;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (status != GL_TRUE)
+	{
+		char log[1024];
+		glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+		qDebug() << QString("Indirect scene cull shader compilation failed: %1").arg(log);
+	}
+
+	m_cullProgram = glCreateProgram();
+	glAttachShader(m_cullProgram, shader);
+	glLinkProgram(m_cullProgram);
+	glDetachShader(m_cullProgram, shader);
+	glDeleteShader(shader);
+
+	glGetProgramiv(m_cullProgram, GL_LINK_STATUS, &status);
+	if (status != GL_TRUE)
+	{
+		char log[1024];
+		glGetProgramInfoLog(m_cullProgram, sizeof(log), nullptr, log);
+		qDebug() << QString("Indirect scene cull program link failed: %1").arg(log);
+	}
+
+	m_planesLocation = glGetUniformLocation(m_cullProgram, "u_planes");
+	m_instanceCountLocation = glGetUniformLocation(m_cullProgram, "u_instanceCount");
+}
+
+OculusVROpenGLWidget::OVRIndirectScene::~OVRIndirectScene()
+{
+	DeleteBuffer(m_vertexBuffer);
+	DeleteBuffer(m_indexBuffer);
+	DeleteBuffer(m_meshBuffer);
+	DeleteBuffer(m_modelBuffer);
+	DeleteBuffer(m_instanceMeshBuffer);
+	DeleteBuffer(m_instanceIdBuffer);
+	DeleteBuffer(m_commandBuffer);
+	DeleteBuffer(m_parameterBuffer);
+	if (m_vao) glDeleteVertexArrays(1, &m_vao);
+	if (m_cullProgram) glDeleteProgram(m_cullProgram);
+}
+
+void OculusVROpenGLWidget::OVRIndirectScene::SetVertexAttribute(GLuint location, GLint size, GLenum type, GLuint offset, bool normalized)
+{
+	glEnableVertexArrayAttrib(m_vao, location);
+	glVertexArrayAttribFormat(m_vao, location, size, type, normalized ? GL_TRUE : GL_FALSE, offset);
+	glVertexArrayAttribBinding(m_vao, location, 0);
+}
+
+int OculusVROpenGLWidget::OVRIndirectScene::AddMesh(const void* vertices, int vertexCount, const GLuint* indices, int indexCount, Vector3f center, float radius)
+{
+	Mesh mesh;
+	mesh.center[_X] = center.x;
+	mesh.center[_Y] = center.y;
+	mesh.center[_Z] = center.z;
+	mesh.radius = radius;
+	mesh.indexCount = indexCount;
+	mesh.firstIndex = m_indices.size();
+	mesh.baseVertex = m_vertices.size() / m_vertexStride;
+	mesh.padding = 0;
+
+	m_vertices.append(static_cast<const char*>(vertices), vertexCount * m_vertexStride);
+	for (int i = 0; i < indexCount; ++i)
+		m_indices.append(indices[i]);
+
+	m_meshes.append(mesh);
+	m_geometryDirty = true;
+
+	return m_meshes.size() - 1;
+}
+
+int OculusVROpenGLWidget::OVRIndirectScene::AddInstance(int meshId, const Matrix4f& model)
+{
+	if (meshId < 0 || meshId >= m_meshes.size())
+	{
+		qDebug() << QString("AddInstance: invalid mesh ID %1").arg(meshId);
+		return -1;
+	}
+
+	m_models.append(model.Transposed());
+	m_instanceMeshes.append(meshId);
+	m_instancesDirty = true;
+
+	return m_models.size() - 1;
+}
+
+void OculusVROpenGLWidget::OVRIndirectScene::SetInstanceModel(int instanceId, const Matrix4f& model)
+{
+	if (instanceId < 0 || instanceId >= m_models.size())
+	{
+		qDebug() << QString("SetInstanceModel: invalid instance ID %1").arg(instanceId);
+		return;
+	}
+
+	m_models[instanceId] = model.Transposed();
+
+	// Instances already on the GPU are updated in place by the next Upload(), in one range
+	if (instanceId < m_uploadedInstances)
+	{
+		if (m_dirtyModelsBegin == m_dirtyModelsEnd)
+		{
+			m_dirtyModelsBegin = instanceId;
+			m_dirtyModelsEnd = instanceId + 1;
+		}
+		else
+		{
+			m_dirtyModelsBegin = qMin(m_dirtyModelsBegin, instanceId);
+			m_dirtyModelsEnd = qMax(m_dirtyModelsEnd, instanceId + 1);
+		}
+	}
+}
+
+int OculusVROpenGLWidget::OVRIndirectScene::GetInstanceCount() const
+{
+	return m_models.size();
+}
+
+void OculusVROpenGLWidget::OVRIndirectScene::Upload()
+{
+	if (m_geometryDirty)
+	{
+		DeleteBuffer(m_vertexBuffer);
+		DeleteBuffer(m_indexBuffer);
+		DeleteBuffer(m_meshBuffer);
+
+		m_vertexBuffer = CreateBuffer(m_vertices.size(), m_vertices.constData(), GL_STATIC_DRAW);
+		m_indexBuffer = CreateBuffer(m_indices.size() * sizeof(GLuint), m_indices.constData(), GL_STATIC_DRAW);
+		m_meshBuffer = CreateBuffer(m_meshes.size() * sizeof(Mesh), m_meshes.constData(), GL_STATIC_DRAW);
+
+		glVertexArrayVertexBuffer(m_vao, 0, m_vertexBuffer, 0, m_vertexStride);
+		glVertexArrayElementBuffer(m_vao, m_indexBuffer);
+
+		m_geometryDirty = false;
+	}
+
+	if (m_instancesDirty)
+	{
+		DeleteBuffer(m_modelBuffer);
+		DeleteBuffer(m_instanceMeshBuffer);
+		DeleteBuffer(m_instanceIdBuffer);
+		DeleteBuffer(m_commandBuffer);
+
+		int count = m_models.size();
+
+		QVector<GLuint> instanceIds(count);
+		for (int i = 0; i < count; ++i)
+			instanceIds[i] = i;
+
+		m_modelBuffer = CreateBuffer(count * sizeof(Matrix4f), m_models.constData(), GL_DYNAMIC_DRAW);
+		m_instanceMeshBuffer = CreateBuffer(count * sizeof(GLuint), m_instanceMeshes.constData(), GL_STATIC_DRAW);
+		m_instanceIdBuffer = CreateBuffer(count * sizeof(GLuint), instanceIds.constData(), GL_STATIC_DRAW);
+		m_commandBuffer = CreateBuffer(count * 5 * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+
+		// The instance index is an instanced attribute: the base instance of each command selects it.
+		glVertexArrayVertexBuffer(m_vao, 1, m_instanceIdBuffer, 0, sizeof(GLuint));
+		glVertexArrayBindingDivisor(m_vao, 1, 1);
+		glEnableVertexArrayAttrib(m_vao, m_instanceLocation);
+		glVertexArrayAttribIFormat(m_vao, m_instanceLocation, 1, GL_UNSIGNED_INT, 0);
+		glVertexArrayAttribBinding(m_vao, m_instanceLocation, 1);
+
+		m_uploadedInstances = count;
+		m_instancesDirty = false;
+		m_dirtyModelsBegin = m_dirtyModelsEnd = 0;
+	}
+
+	if (m_dirtyModelsBegin < m_dirtyModelsEnd)
+	{
+		glNamedBufferSubData(m_modelBuffer, m_dirtyModelsBegin * sizeof(Matrix4f), (m_dirtyModelsEnd - m_dirtyModelsBegin) * sizeof(Matrix4f), &m_models[m_dirtyModelsBegin]);
+		m_dirtyModelsBegin = m_dirtyModelsEnd = 0;
+	}
+}
+
+GLuint OculusVROpenGLWidget::OVRIndirectScene::CreateBuffer(GLsizeiptr size, const void* data, GLenum usage)
+{
+	if (m_memoryTracker)
+		m_memoryTracker->Reserve(size);
+
+	GLuint buffer = 0;
+	glCreateBuffers(1, &buffer);
+	glNamedBufferData(buffer, size, data, usage);
+	if (m_memoryTracker)
+		m_memoryTracker->Track(OVRMemoryTracker::Buffers, buffer, size);
+	return buffer;
+}
+
+void OculusVROpenGLWidget::OVRIndirectScene::DeleteBuffer(GLuint& buffer)
+{
+	if (!buffer)
+		return;
+	if (m_memoryTracker)
+		m_memoryTracker->Untrack(OVRMemoryTracker::Buffers, buffer);
+	glDeleteBuffers(1, &buffer);
+	buffer = 0;
+}
+
+/// Extract the normalized frustum planes from the rows of a projection * view matrix:
+/// left, right, bottom, top, near, far.
+static void FrustumPlanes(const Matrix4f& viewProj, float planes[6][4])
+{
+	for (int i = 0; i < 3; ++i)
+	{
+		for (int j = 0; j < 4; ++j)
+		{
+			planes[2 * i][j] = viewProj.M[3][j] + viewProj.M[i][j];
+			planes[2 * i + 1][j] = viewProj.M[3][j] - viewProj.M[i][j];
+		}
+	}
+	for (int i = 0; i < 6; ++i)
+	{
+		float length = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+		for (int j = 0; j < 4; ++j)
+			planes[i][j] /= length;
+	}
+}
+
+void OculusVROpenGLWidget::OVRIndirectScene::Cull(const Matrix4f& viewProj)
+{
+	Upload();
+	if (m_uploadedInstances == 0)
+		return;
+
+	float planes[6][4];
+	FrustumPlanes(viewProj, planes);
+
+	// Without glMultiDrawElementsIndirectCount all commands are drawn: unused ones must draw nothing.
+	GLuint zero = 0;
+	glClearNamedBufferData(m_parameterBuffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	if (!m_multiDrawElementsIndirectCount)
+		glClearNamedBufferData(m_commandBuffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+	glUseProgram(m_cullProgram);
+	glUniform4fv(m_planesLocation, 6, &planes[0][0]);
+	glUniform1ui(m_instanceCountLocation, m_uploadedInstances);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_modelBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_instanceMeshBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_meshBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_commandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_parameterBuffer);
+
+	glDispatchCompute((m_uploadedInstances + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(0);
+}
+
+void OculusVROpenGLWidget::OVRIndirectScene::Draw()
+{
+	if (m_uploadedInstances == 0)
+		return;
+
+	glBindVertexArray(m_vao);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OVR_SCENE_INSTANCE_BINDING, m_modelBuffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+
+	if (m_multiDrawElementsIndirectCount)
+	{
+		glBindBuffer(GL_PARAMETER_BUFFER, m_parameterBuffer);
+		m_multiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, 0, m_uploadedInstances, 0);
+		glBindBuffer(GL_PARAMETER_BUFFER, 0);
+	}
+	else
+	{
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, m_uploadedInstances, 0);
+	}
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glBindVertexArray(0);
+}
+
+void OculusVROpenGLWidget::OVRIndirectScene::DrawUnbatched()
+{
+	Upload();
+	if (m_uploadedInstances == 0)
+		return;
+
+	glBindVertexArray(m_vao);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OVR_SCENE_INSTANCE_BINDING, m_modelBuffer);
+
+	for (int instance = 0; instance < m_uploadedInstances; ++instance)
+	{
+		const Mesh& mesh = m_meshes[m_instanceMeshes[instance]];
+		glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT,
+			reinterpret_cast<const void*>(mesh.firstIndex * sizeof(GLuint)), 1, mesh.baseVertex, instance);
+	}
+
+	glBindVertexArray(0);
+}
+
+/// Vertex of the benchmark scene meshes
+struct BenchmarkVertex
+{
+	float position[3];
+	float normal[3];
+};
+
+/// Add a sphere of diameter 1 to a benchmark scene.
+static int AddBenchmarkSphere(OculusVROpenGLWidget::OVRIndirectScene* scene, int slices, int stacks)
+{
+	QVector<BenchmarkVertex> vertices;
+	QVector<GLuint> indices;
+
+	for (int stack = 0; stack <= stacks; ++stack)
+	{
+		float theta = MATH_FLOAT_PI * stack / stacks;
+		for (int slice = 0; slice <= slices; ++slice)
+		{
+			float phi = 2.0f * MATH_FLOAT_PI * slice / slices;
+			BenchmarkVertex vertex;
+			vertex.normal[_X] = sinf(theta) * cosf(phi);
+			vertex.normal[_Y] = cosf(theta);
+			vertex.normal[_Z] = sinf(theta) * sinf(phi);
+			for (int i = 0; i < 3; ++i)
+				vertex.position[i] = 0.5f * vertex.normal[i];
+			vertices.append(vertex);
+		}
+	}
+
+	for (int stack = 0; stack < stacks; ++stack)
+	{
+		for (int slice = 0; slice < slices; ++slice)
+		{
+			GLuint first = stack * (slices + 1) + slice;
+			GLuint second = first + slices + 1;
+			indices.append(first);
+			indices.append(first + 1);
+			indices.append(second);
+			indices.append(second);
+			indices.append(first + 1);
+			indices.append(second + 1);
+		}
+	}
+
+	return scene->AddMesh(vertices.constData(), vertices.size(), indices.constData(), indices.size(), Vector3f(), 0.5f);
+}
+
+/// Add a box of side 0.8 to a benchmark scene.
+static int AddBenchmarkBox(OculusVROpenGLWidget::OVRIndirectScene* scene)
+{
+	QVector<BenchmarkVertex> vertices;
+	QVector<GLuint> indices;
+
+	for (int face = 0; face < 6; ++face)
+	{
+		// Face normal along the axis face / 2, u and v along the two others
+		int axis = face / 2;
+		float sign = (face % 2) ? -1.0f : 1.0f;
+		int u = (axis + 1) % 3;
+		int v = (axis + 2) % 3;
+
+		GLuint first = vertices.size();
+		for (int corner = 0; corner < 4; ++corner)
+		{
+			BenchmarkVertex vertex;
+			vertex.position[axis] = 0.4f * sign;
+			vertex.position[u] = (corner == 1 || corner == 2) ? 0.4f : -0.4f;
+			vertex.position[v] = (corner >= 2) ? 0.4f * sign : -0.4f * sign;
+			vertex.normal[axis] = sign;
+			vertex.normal[u] = 0.0f;
+			vertex.normal[v] = 0.0f;
+			vertices.append(vertex);
+		}
+
+		indices.append(first);
+		indices.append(first + 1);
+		indices.append(first + 2);
+		indices.append(first);
+		indices.append(first + 2);
+		indices.append(first + 3);
+	}
+
+	return scene->AddMesh(vertices.constData(), vertices.size(), indices.constData(), indices.size(), Vector3f(), 0.4f * sqrtf(3.0f));
+}
+
+OculusVROpenGLWidget::OVRIndirectScene* OculusVROpenGLWidget::OVRIndirectScene::CreateBenchmarkScene(int instanceCount, OVRMemoryTracker* memoryTracker, float spacing)
+{
+	OVRIndirectScene* scene = new OVRIndirectScene(sizeof(BenchmarkVertex), 2, memoryTracker);
+	scene->SetVertexAttribute(0, 3, GL_FLOAT, offsetof(BenchmarkVertex, position));
+	scene->SetVertexAttribute(1, 3, GL_FLOAT, offsetof(BenchmarkVertex, normal));
+
+	// From 12 to 1024 triangles
+	int meshes[4];
+	meshes[0] = AddBenchmarkBox(scene);
+	meshes[1] = AddBenchmarkSphere(scene, 8, 6);
+	meshes[2] = AddBenchmarkSphere(scene, 16, 12);
+	meshes[3] = AddBenchmarkSphere(scene, 32, 16);
+
+	int side = qMax(1, static_cast<int>(ceilf(cbrtf(static_cast<float>(instanceCount)))));
+	float offset = 0.5f * (side - 1) * spacing;
+
+	for (int instance = 0; instance < instanceCount; ++instance)
+	{
+		Vector3f position(
+			(instance % side) * spacing - offset,
+			((instance / side) % side) * spacing - offset,
+			(instance / (side * side)) * spacing - offset);
+		scene->AddInstance(meshes[instance % 4], Matrix4f::Translation(position) * Matrix4f::RotationY(0.7f * instance));
+	}
+
+	return scene;
+}
+
+/// Vertex shader of the benchmark scene, after the version and the INSTANCE_BINDING definition.
+static const char* s_benchmarkVertexShader = R"(
+layout(location = 0) in vec3 a_position;
+layout(location = 1) in vec3 a_normal;
+layout(location = 2) in uint a_instance;
+
+layout(std430, binding = INSTANCE_BINDING) readonly buffer Instances { mat4 models[]; };
+
+uniform mat4 u_viewProj;
+
+out vec3 v_normal;
+out vec3 v_color;
+
+void main()
+{
+	mat4 model = models[a_instance];
+	v_normal = mat3(model) * a_normal;
+	v_color = vec3(a_instance % 7u, a_instance % 5u, a_instance % 3u) / vec3(6.0, 4.0, 2.0) * 0.6 + 0.4;
+	gl_Position = u_viewProj * model * vec4(a_position, 1.0);
+}
+)";
+
+/// Fragment shader of the benchmark scene, lit by a directional light.
+static const char* s_benchmarkFragmentShader = R"(
+#version 430
+in vec3 v_normal;
+in vec3 v_color;
+
+out vec4 fragColor;
+
+void main()
+{
+	float light = 0.3 + 0.7 * max(dot(normalize(v_normal), normalize(vec3(0.3, 1.0, 0.5))), 0.0);
+	fragColor = vec4(v_color * light, 1.0);
+}
+)";
+
+QMap<GLenum, QByteArray> OculusVROpenGLWidget::OVRIndirectScene::GetBenchmarkProgramSources()
+{
+	QMap<GLenum, QByteArray> sources;
+	sources.insert(GL_VERTEX_SHADER, QByteArray("#version 430\n#define INSTANCE_BINDING ") + QByteArray::number(OVR_SCENE_INSTANCE_BINDING) + s_benchmarkVertexShader);
+	sources.insert(GL_FRAGMENT_SHADER, s_benchmarkFragmentShader);
+	return sources;
+}
+
+
+
+
+
+
+// ////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// PROGRAM CACHE
+// 
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+OculusVROpenGLWidget::OVRProgramCache::OVRProgramCache(const QString& directory) :
+	m_directory(directory),
+	m_binarySupported(false),
+	m_parallelCompile(false)
+{
+	initializeOpenGLFunctions();
+
+	m_statistics.hits = 0;
+	m_statistics.misses = 0;
+	m_statistics.rejected = 0;
+	m_statistics.loadTime = 0.0;
+	m_statistics.compileTime = 0.0;
+
+	// A driver update invalidates the binaries
+	m_driver = QByteArray(reinterpret_cast<const char*>(glGetString(GL_VENDOR))) + "/" +
+		QByteArray(reinterpret_cast<const char*>(glGetString(GL_RENDERER))) + "/" +
+		QByteArray(reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+
+	GLint formatCount = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+	m_binarySupported = formatCount > 0;
+	if (m_binarySupported && !QDir().mkpath(m_directory))
+	{
+		qDebug() << QString("Failed to create the programs cache directory: %1").arg(m_directory);
+		m_binarySupported = false;
+	}
+
+	QOpenGLContext* context = QOpenGLContext::currentContext();
+	MaxShaderCompilerThreads maxShaderCompilerThreads = nullptr;
+	if (context->hasExtension("GL_KHR_parallel_shader_compile"))
+		maxShaderCompilerThreads = reinterpret_cast<MaxShaderCompilerThreads>(context->getProcAddress("glMaxShaderCompilerThreadsKHR"));
+	else if (context->hasExtension("GL_ARB_parallel_shader_compile"))
+		maxShaderCompilerThreads = reinterpret_cast<MaxShaderCompilerThreads>(context->getProcAddress("glMaxShaderCompilerThreadsARB"));
+
+	if (maxShaderCompilerThreads)
+	{
+		// Let the driver choose the number of threads
+		maxShaderCompilerThreads(0xFFFFFFFF);
+		m_parallelCompile = true;
+	}
+}
+
+OculusVROpenGLWidget::OVRProgramCache::~OVRProgramCache()
+{
+	for (int i = 0; i < m_pending.size(); ++i)
+	{
+		for (int j = 0; j < m_pending[i].shaders.size(); ++j)
+			glDeleteShader(m_pending[i].shaders[j]);
+	}
+}
+
+QByteArray OculusVROpenGLWidget::OVRProgramCache::Key(const QMap<GLenum, QByteArray>& sources) const
+{
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	hash.addData(m_driver);
+	for (QMap<GLenum, QByteArray>::const_iterator it = sources.constBegin(); it != sources.constEnd(); ++it)
+	{
+		GLenum stage = it.key();
+		hash.addData(reinterpret_cast<const char*>(&stage), sizeof(stage));
+		hash.addData(it.value());
+	}
+	return hash.result().toHex();
+}
+
+QString OculusVROpenGLWidget::OVRProgramCache::FilePath(const QByteArray& key) const
+{
+	return QDir(m_directory).filePath(QString::fromLatin1(key) + ".bin");
+}
+
+GLuint OculusVROpenGLWidget::OVRProgramCache::LoadProgram(const QMap<GLenum, QByteArray>& sources)
+{
+	QElapsedTimer timer;
+	timer.start();
+
+	QByteArray key = Key(sources);
+	GLuint program = glCreateProgram();
+
+	// Cache hit: file is the binary format followed by the binary
+	if (m_binarySupported)
+	{
+		QFile file(FilePath(key));
+		if (file.open(QFile::ReadOnly))
+		{
+			QByteArray binary = file.readAll();
+			file.close();
+
+			if (binary.size() > int(sizeof(GLenum)))
+			{
+				GLenum format;
+				memcpy(&format, binary.constData(), sizeof(format));
+				glProgramBinary(program, format, binary.constData() + sizeof(format), binary.size() - sizeof(format));
+
+				GLint status = GL_FALSE;
+				glGetProgramiv(program, GL_LINK_STATUS, &status);
+				if (status == GL_TRUE)
+				{
+					m_statistics.hits++;
+					m_statistics.loadTime += timer.nsecsElapsed() / 1000000.0;
+					return program;
+				}
+			}
+
+			// Driver rejected the binary (updated driver, corrupted file...): compile again.
+			m_statistics.rejected++;
+			QFile::remove(FilePath(key));
+			glDeleteProgram(program);
+			program = glCreateProgram();
+		}
+	}
+
+	// Cache miss
+	m_statistics.misses++;
+
+	Pending pending;
+	pending.program = program;
+	pending.key = key;
+
+	for (QMap<GLenum, QByteArray>::const_iterator it = sources.constBegin(); it != sources.constEnd(); ++it)
+	{
+		GLuint shader = glCreateShader(it.key());
+		const char* source = it.value().constData();
+		glShaderSource(shader, 1, &source, nullptr);
+		glCompileShader(shader);
+		glAttachShader(program, shader);
+		pending.shaders.append(shader);
+	}
+
+	if (m_binarySupported)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(program);
+
+	m_pending.append(pending);
+
+	// Without parallel compilation, querying the link status waits for it anyway.
+	if (!m_parallelCompile)
+		Complete(m_pending.size() - 1);
+
+	m_statistics.compileTime += timer.nsecsElapsed() / 1000000.0;
+
+	return program;
+}
+
+bool OculusVROpenGLWidget::OVRProgramCache::IsReady(GLuint program)
+{
+	for (int i = 0; i < m_pending.size(); ++i)
+	{
+		if (m_pending[i].program != program)
+			continue;
+
+		GLint completed = GL_TRUE;
+		glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &completed);
+		if (completed != GL_TRUE)
+			return false;
+
+		Complete(i);
+		break;
+	}
+
+	return true;
+}
+
+void OculusVROpenGLWidget::OVRProgramCache::Finish()
+{
+	QElapsedTimer timer;
+	timer.start();
+
+	bool waited = !m_pending.isEmpty();
+	while (!m_pending.isEmpty())
+		Complete(m_pending.size() - 1);
+
+	if (waited)
+		m_statistics.compileTime += timer.nsecsElapsed() / 1000000.0;
+}
+
+OculusVROpenGLWidget::OVRProgramCache::Statistics OculusVROpenGLWidget::OVRProgramCache::GetStatistics() const
+{
+	return m_statistics;
+}
+
+void OculusVROpenGLWidget::OVRProgramCache::Complete(int pendingIndex)
+{
+	Pending pending = m_pending[pendingIndex];
+	m_pending.remove(pendingIndex);
+
+	GLint status = GL_FALSE;
+	glGetProgramiv(pending.program, GL_LINK_STATUS, &status);
+	if (status != GL_TRUE)
+	{
+		char log[1024];
+		for (int i = 0; i < pending.shaders.size(); ++i)
+		{
+			glGetShaderInfoLog(pending.shaders[i], sizeof(log), nullptr, log);
+			if (log[0])
+				qDebug() << QString("Shader compilation failed: %1").arg(log);
+		}
+		glGetProgramInfoLog(pending.program, sizeof(log), nullptr, log);
+		qDebug() << QString("Program link failed: %1").arg(log);
+	}
+
+	for (int i = 0; i < pending.shaders.size(); ++i)
+	{
+		glDetachShader(pending.program, pending.shaders[i]);
+		glDeleteShader(pending.shaders[i]);
+	}
+
+	if (status != GL_TRUE || !m_binarySupported)
+		return;
+
+	GLint length = 0;
+	glGetProgramiv(pending.program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	QByteArray binary;
+	binary.resize(sizeof(GLenum) + length);
+	GLenum format = 0;
+	glGetProgramBinary(pending.program, length, nullptr, &format, binary.data() + sizeof(GLenum));
+	memcpy(binary.data(), &format, sizeof(format));
+
+	QSaveFile file(FilePath(pending.key));
+	if (!file.open(QFile::WriteOnly) || file.write(binary) != binary.size() || !file.commit())
+		qDebug() << QString("Failed to store the program binary: %1").arg(FilePath(pending.key));
+}
+
+
+
+
+
+
+// ////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// FRAME ALLOCATOR
+// 
+
+OculusVROpenGLWidget::OVRFrameAllocator::OVRFrameAllocator() :
+	m_buffer(0),
+	m_offset(0),
+	m_capacity(0),
+	m_used(0),
+	m_data(nullptr)
+{
+}
+
+OculusVROpenGLWidget::OVRFrameAllocator::Allocation OculusVROpenGLWidget::OVRFrameAllocator::Allocate(GLsizeiptr size, GLsizeiptr alignment)
+{
+	Allocation allocation = { nullptr, m_buffer, 0 };
+
+	// Align the offset in the buffer, not in the region
+	GLintptr offset = ((m_offset + m_used + alignment - 1) / alignment) * alignment;
+	if (offset + size > m_offset + m_capacity)
+	{
+		qDebug() << QString("Frame allocator exhausted: %1 bytes requested, %2 bytes used on %3.").arg(qint64(size)).arg(qint64(m_used)).arg(qint64(m_capacity));
+		return allocation;
+	}
+
+	allocation.data = m_data + (offset - m_offset);
+	allocation.offset = offset;
+	m_used = offset + size - m_offset;
+
+	return allocation;
+}
+
+GLsizeiptr OculusVROpenGLWidget::OVRFrameAllocator::GetUsedSize() const
+{
+	return m_used;
+}
+
+GLsizeiptr OculusVROpenGLWidget::OVRFrameAllocator::GetCapacity() const
+{
+	return m_capacity;
+}
+
+void OculusVROpenGLWidget::OVRFrameAllocator::Reset(GLuint buffer, GLintptr offset, GLsizeiptr capacity, char* data)
+{
+	m_buffer = buffer;
+	m_offset = offset;
+	m_capacity = capacity;
+	m_used = 0;
+	m_data = data;
+}
+
+
+
+
+
+
+// ////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// OCCLUSION CULLER
+// 
+
+/// Hi-Z build shader: level 0 is a copy of the depth, each next level keeps the farthest depth
+/// of its source texels (including the extra row/column of odd sizes).
+static const char* s_hiZShader = R"(
+#version 430
+layout(local_size_x = 8, local_size_y = 8) in;
+layout(r32f, binding = 0) uniform writeonly image2D u_destination;
+layout(r32f, binding = 1) uniform readonly image2D u_source;
+uniform sampler2D u_depth;
+uniform bool u_fromDepth;
+
+void main()
+{
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(u_destination);
+	if (any(greaterThanEqual(texel, size)))
+		return;
+
+	if (u_fromDepth)
+	{
+		imageStore(u_destination, texel, vec4(texelFetch(u_depth, texel, 0).r));
+		return;
+	}
+
+	ivec2 sourceSize = imageSize(u_source);
+	ivec2 first = texel * 2;
+	ivec2 last = min(first + ivec2(1) + ivec2(equal(texel, size - 1)) * (sourceSize & 1), sourceSize - 1);
+
+	float depth = 0.0;
+	for (int y = first.y; y <= last.y; ++y)
+	{
+		for (int x = first.x; x <= last.x; ++x)
+			depth = max(depth, imageLoad(u_source, ivec2(x, y)).r);
+	}
+	imageStore(u_destination, texel, vec4(depth));
+}
+)";
+
+/// Cull shader: one invocation per object for both eyes.
+static const char* s_occlusionCullShader = R"(
+#version 430
+layout(local_size_x = 64) in;
+layout(std430, binding = 0) readonly buffer Bounds { vec4 spheres[]; };
+layout(std430, binding = 1) buffer Visibility { uint visibility[]; };
+
+uniform sampler2D u_hiZ;
+uniform bool u_occlusion;
+uniform mat4 u_occluderViewProj;
+uniform vec4 u_planes[12];
+uniform uint u_objectCount;
+uniform uint u_wordCount;
+uniform float u_margin;
+
+bool Occluded(vec3 center, float radius)
+{
+	// Window rectangle and nearest depth of the sphere bounding box in the occluder view
+	vec3 minimum = vec3(1.0);
+	vec3 maximum = vec3(0.0);
+	for (int i = 0; i < 8; ++i)
+	{
+		vec3 corner = center + radius * vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+		vec4 clip = u_occluderViewProj * vec4(corner, 1.0);
+		if (clip.w <= 0.0)
+			return false;
+		vec3 window = (clip.xyz / clip.w) * 0.5 + 0.5;
+		minimum = min(minimum, window);
+		maximum = max(maximum, window);
+	}
+
+	// Nothing is known outside of the occluder view
+	if (any(lessThan(minimum.xy, vec2(0.0))) || any(greaterThan(maximum.xy, vec2(1.0))))
+		return false;
+
+	// Level where the rectangle covers at most 2x2 texels
+	vec2 extent = (maximum.xy - minimum.xy) * vec2(textureSize(u_hiZ, 0));
+	int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, textureQueryLevels(u_hiZ) - 1);
+	ivec2 levelSize = textureSize(u_hiZ, level);
+	ivec2 first = clamp(ivec2(minimum.xy * vec2(levelSize)), ivec2(0), levelSize - 1);
+	ivec2 last = clamp(ivec2(maximum.xy * vec2(levelSize)), ivec2(0), levelSize - 1);
+
+	float farthest = 0.0;
+	for (int y = first.y; y <= last.y; ++y)
+	{
+		for (int x = first.x; x <= last.x; ++x)
+			farthest = max(farthest, texelFetch(u_hiZ, ivec2(x, y), level).r);
+	}
+
+	return minimum.z > farthest;
+}
+
+void main()
+{
+	uint object = gl_GlobalInvocationID.x;
+	if (object >= u_objectCount)
+		return;
+
+	vec4 sphere = spheres[object];
+	if (u_occlusion && Occluded(sphere.xyz, sphere.w + u_margin))
+		return;
+
+	// Not occluded bit, the only result read back: the frustum changes until the results are read
+	atomicOr(visibility[2u * u_wordCount + object / 32u], 1u << (object % 32u));
+
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		bool inside = true;
+		for (int i = 0; i < 6; ++i)
+		{
+			vec4 plane = u_planes[eye * 6 + i];
+			if (dot(plane.xyz, sphere.xyz) + plane.w < -sphere.w)
+				inside = false;
+		}
+		if (inside)
+			atomicOr(visibility[uint(eye) * u_wordCount + object / 32u], 1u << (object % 32u));
+	}
+}
+)";
+
+OculusVROpenGLWidget::OVROcclusionCuller::OVROcclusionCuller(OVRProgramCache* programCache, OVRMemoryTracker* memoryTracker) :
+	m_programCache(programCache),
+	m_memoryTracker(memoryTracker),
+	m_hiZProgram(0),
+	m_cullProgram(0),
+	m_hiZTexId(0),
+	m_hiZWidth(0),
+	m_hiZHeight(0),
+	m_hiZLevels(0),
+	m_objectCount(0),
+	m_wordCount(0),
+	m_boundsBuffer(0),
+	m_visibilityBuffer(0),
+	m_readbackBuffer(0),
+	m_readbackData(nullptr),
+	m_serial(0),
+	m_resultSerial(-1)
+{
+	initializeOpenGLFunctions();
+
+	for (int i = 0; i < ReadbackSlots; ++i)
+	{
+		m_readbacks[i].fence = nullptr;
+		m_readbacks[i].serial = -1;
+		m_readbacks[i].objectCount = 0;
+	}
+	// No frustum before the first Cull(): every plane accepts everything
+	memset(m_planes, 0, sizeof(m_planes));
+
+	QMap<GLenum, QByteArray> sources;
+	sources.insert(GL_COMPUTE_SHADER, s_hiZShader);
+	m_hiZProgram = m_programCache->LoadProgram(sources);
+
+	sources.insert(GL_COMPUTE_SHADER, s_occlusionCullShader);
+	m_cullProgram = m_programCache->LoadProgram(sources);
+}
+
+OculusVROpenGLWidget::OVROcclusionCuller::~OVROcclusionCuller()
+{
+	for (int i = 0; i < ReadbackSlots; ++i)
+	{
+		if (m_readbacks[i].fence) glDeleteSync(m_readbacks[i].fence);
+	}
+	if (m_readbackBuffer)
+	{
+		if (m_memoryTracker) m_memoryTracker->Untrack(OVRMemoryTracker::Buffers, m_readbackBuffer);
+		glUnmapNamedBuffer(m_readbackBuffer);
+		glDeleteBuffers(1, &m_readbackBuffer);
+	}
+	if (m_memoryTracker)
+	{
+		m_memoryTracker->Untrack(OVRMemoryTracker::Buffers, m_boundsBuffer);
+		m_memoryTracker->Untrack(OVRMemoryTracker::Buffers, m_visibilityBuffer);
+		m_memoryTracker->Untrack(OVRMemoryTracker::Textures, m_hiZTexId);
+	}
+	if (m_boundsBuffer) glDeleteBuffers(1, &m_boundsBuffer);
+	if (m_visibilityBuffer) glDeleteBuffers(1, &m_visibilityBuffer);
+	if (m_hiZTexId) glDeleteTextures(1, &m_hiZTexId);
+	if (m_hiZProgram) glDeleteProgram(m_hiZProgram);
+	if (m_cullProgram) glDeleteProgram(m_cullProgram);
+}
+
+void OculusVROpenGLWidget::OVROcclusionCuller::SetBounds(const QVector<Vector4f>& spheres)
+{
+	// Moving objects: update in place, the pending readbacks stay valid
+	if (m_boundsBuffer && spheres.size() == m_objectCount)
+	{
+		glNamedBufferSubData(m_boundsBuffer, 0, m_objectCount * sizeof(Vector4f), spheres.constData());
+		m_bounds = spheres;
+		return;
+	}
+
+	// Pending readbacks of the previous objects are dropped (deleted buffers live until the GPU is done with them)
+	for (int i = 0; i < ReadbackSlots; ++i)
+	{
+		if (m_readbacks[i].fence) glDeleteSync(m_readbacks[i].fence);
+		m_readbacks[i].fence = nullptr;
+		m_readbacks[i].serial = -1;
+	}
+	if (m_readbackBuffer)
+	{
+		if (m_memoryTracker) m_memoryTracker->Untrack(OVRMemoryTracker::Buffers, m_readbackBuffer);
+		glUnmapNamedBuffer(m_readbackBuffer);
+		glDeleteBuffers(1, &m_readbackBuffer);
+		m_readbackBuffer = 0;
+		m_readbackData = nullptr;
+	}
+	if (m_memoryTracker)
+	{
+		m_memoryTracker->Untrack(OVRMemoryTracker::Buffers, m_boundsBuffer);
+		m_memoryTracker->Untrack(OVRMemoryTracker::Buffers, m_visibilityBuffer);
+	}
+	if (m_boundsBuffer) glDeleteBuffers(1, &m_boundsBuffer);
+	if (m_visibilityBuffer) glDeleteBuffers(1, &m_visibilityBuffer);
+	m_boundsBuffer = m_visibilityBuffer = 0;
+	m_bounds.clear();
+	m_unoccluded.clear();
+	m_resultSerial = -1;
+
+	m_objectCount = spheres.size();
+	m_wordCount = (m_objectCount + 31) / 32;
+	if (m_objectCount == 0)
+		return;
+	m_bounds = spheres;
+
+	// Left eye, right eye and not occluded bitmasks; only the last one is read back
+	GLsizeiptr visibilitySize = 3 * m_wordCount * sizeof(quint32);
+	GLsizeiptr readbackSize = ReadbackSlots * m_wordCount * sizeof(quint32);
+	if (m_memoryTracker)
+		m_memoryTracker->Reserve(m_objectCount * sizeof(Vector4f) + visibilitySize + readbackSize);
+
+	glCreateBuffers(1, &m_boundsBuffer);
+	glNamedBufferStorage(m_boundsBuffer, m_objectCount * sizeof(Vector4f), spheres.constData(), GL_DYNAMIC_STORAGE_BIT);
+
+	glCreateBuffers(1, &m_visibilityBuffer);
+	glNamedBufferStorage(m_visibilityBuffer, visibilitySize, nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+	GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glCreateBuffers(1, &m_readbackBuffer);
+	glNamedBufferStorage(m_readbackBuffer, readbackSize, nullptr, flags);
+	m_readbackData = static_cast<const quint32*>(glMapNamedBufferRange(m_readbackBuffer, 0, readbackSize, flags));
+
+	if (m_memoryTracker)
+	{
+		m_memoryTracker->Track(OVRMemoryTracker::Buffers, m_boundsBuffer, m_objectCount * sizeof(Vector4f));
+		m_memoryTracker->Track(OVRMemoryTracker::Buffers, m_visibilityBuffer, visibilitySize);
+		m_memoryTracker->Track(OVRMemoryTracker::Buffers, m_readbackBuffer, readbackSize);
+	}
+	if (!m_readbackData)
+		qDebug() << "Failed to map the occlusion culling readback buffer.";
+}
+
+int OculusVROpenGLWidget::OVROcclusionCuller::GetObjectCount() const
+{
+	return m_objectCount;
+}
+
+void OculusVROpenGLWidget::OVROcclusionCuller::ResizeHiZ(int width, int height)
+{
+	if (width == m_hiZWidth && height == m_hiZHeight)
+		return;
+
+	if (m_hiZTexId)
+	{
+		if (m_memoryTracker) m_memoryTracker->Untrack(OVRMemoryTracker::Textures, m_hiZTexId);
+		glDeleteTextures(1, &m_hiZTexId);
+	}
+
+	m_hiZWidth = width;
+	m_hiZHeight = height;
+	m_hiZLevels = 1;
+	while ((qMax(width, height) >> m_hiZLevels) > 0)
+		m_hiZLevels++;
+
+	// R32F and its mip chain (a third of level 0)
+	qint64 levelSize = qint64(width) * height * 4;
+	if (m_memoryTracker)
+		m_memoryTracker->Reserve(levelSize + levelSize / 3);
+
+	glCreateTextures(GL_TEXTURE_2D, 1, &m_hiZTexId);
+	glTextureStorage2D(m_hiZTexId, m_hiZLevels, GL_R32F, width, height);
+	if (m_memoryTracker)
+		m_memoryTracker->Track(OVRMemoryTracker::Textures, m_hiZTexId, levelSize + levelSize / 3);
+	glTextureParameteri(m_hiZTexId, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTextureParameteri(m_hiZTexId, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+}
+
+void OculusVROpenGLWidget::OVROcclusionCuller::Cull(GLuint depthTexId, const Matrix4f& occluderViewProj, const Matrix4f& leftViewProj, const Matrix4f& rightViewProj, float eyesDistance)
+{
+	ReadResults();
+
+	if (m_objectCount == 0)
+		return;
+
+	// Hi-Z
+	if (depthTexId)
+	{
+		GLint width = 0, height = 0;
+		glGetTextureLevelParameteriv(depthTexId, 0, GL_TEXTURE_WIDTH, &width);
+		glGetTextureLevelParameteriv(depthTexId, 0, GL_TEXTURE_HEIGHT, &height);
+		ResizeHiZ(width, height);
+
+		glUseProgram(m_hiZProgram);
+		glUniform1i(glGetUniformLocation(m_hiZProgram, "u_depth"), 0);
+		glBindTextureUnit(0, depthTexId);
+
+		for (int level = 0; level < m_hiZLevels; ++level)
+		{
+			glUniform1i(glGetUniformLocation(m_hiZProgram, "u_fromDepth"), level == 0);
+			glBindImageTexture(0, m_hiZTexId, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+			glBindImageTexture(1, m_hiZTexId, level > 0 ? level - 1 : 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+
+			int levelWidth = qMax(1, m_hiZWidth >> level);
+			int levelHeight = qMax(1, m_hiZHeight >> level);
+			glDispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+		}
+
+		glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glBindImageTexture(1, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+	}
+
+	// Frustum planes of the left eye, then of the right eye, kept for IsVisible()
+	FrustumPlanes(leftViewProj, m_planes);
+	FrustumPlanes(rightViewProj, m_planes + 6);
+
+	GLuint zero = 0;
+	glClearNamedBufferData(m_visibilityBuffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+	glUseProgram(m_cullProgram);
+	glUniform1i(glGetUniformLocation(m_cullProgram, "u_hiZ"), 0);
+	glUniform1i(glGetUniformLocation(m_cullProgram, "u_occlusion"), depthTexId != 0);
+	// Matrix4f is row major
+	glUniformMatrix4fv(glGetUniformLocation(m_cullProgram, "u_occluderViewProj"), 1, GL_TRUE, &occluderViewProj.M[0][0]);
+	glUniform4fv(glGetUniformLocation(m_cullProgram, "u_planes"), 12, &m_planes[0][0]);
+	glUniform1ui(glGetUniformLocation(m_cullProgram, "u_objectCount"), m_objectCount);
+	glUniform1ui(glGetUniformLocation(m_cullProgram, "u_wordCount"), m_wordCount);
+	glUniform1f(glGetUniformLocation(m_cullProgram, "u_margin"), eyesDistance);
+
+	glBindTextureUnit(0, depthTexId ? m_hiZTexId : 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_boundsBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_visibilityBuffer);
+
+	glDispatchCompute((m_objectCount + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	glBindTextureUnit(0, 0);
+	glUseProgram(0);
+
+	// Read back the not occluded bitmask without waiting: the slot is reused after ReadbackSlots frames.
+	// Results still unfinished by then are dropped, the GPU copies in order into the slot.
+	m_serial++;
+	Readback& readback = m_readbacks[m_serial % ReadbackSlots];
+	if (readback.fence)
+		glDeleteSync(readback.fence);
+
+	GLsizeiptr maskSize = m_wordCount * sizeof(quint32);
+	glCopyNamedBufferSubData(m_visibilityBuffer, m_readbackBuffer, 2 * maskSize, (m_serial % ReadbackSlots) * maskSize, maskSize);
+	readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	readback.serial = m_serial;
+	readback.objectCount = m_objectCount;
+}
+
+void OculusVROpenGLWidget::OVROcclusionCuller::ReadResults()
+{
+	if (!m_readbackData)
+		return;
+
+	// Newest finished readback
+	int newest = -1;
+	for (int i = 0; i < ReadbackSlots; ++i)
+	{
+		Readback& readback = m_readbacks[i];
+		if (!readback.fence || readback.serial <= m_resultSerial)
+			continue;
+
+		GLenum status = glClientWaitSync(readback.fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			continue;
+
+		if (newest < 0 || readback.serial > m_readbacks[newest].serial)
+			newest = i;
+	}
+
+	if (newest < 0)
+		return;
+
+	m_unoccluded.resize(m_wordCount);
+	memcpy(m_unoccluded.data(), m_readbackData + newest * m_wordCount, m_wordCount * sizeof(quint32));
+	m_resultSerial = m_readbacks[newest].serial;
+}
+
+bool OculusVROpenGLWidget::OVROcclusionCuller::IsVisible(ovrEyeType eye, int object) const
+{
+	if (object < 0 || object >= m_bounds.size())
+		return true;
+
+	// Occlusion results are late, objects without results are not occluded
+	if (object / 32 < m_unoccluded.size() && !((m_unoccluded[object / 32] >> (object % 32)) & 1u))
+		return false;
+
+	// Frustum of the current frame
+	const Vector4f& sphere = m_bounds[object];
+	const float (*planes)[4] = m_planes + (eye == ovrEye_Left ? 0 : 6);
+	for (int i = 0; i < 6; ++i)
+	{
+		if (planes[i][0] * sphere.x + planes[i][1] * sphere.y + planes[i][2] * sphere.z + planes[i][3] < -sphere.w)
+			return false;
+	}
+	return true;
+}
+
+const QVector<quint32>& OculusVROpenGLWidget::OVROcclusionCuller::GetUnoccluded() const
+{
+	return m_unoccluded;
+}
+
+GLuint OculusVROpenGLWidget::OVROcclusionCuller::GetVisibilityBuffer() const
+{
+	return m_visibilityBuffer;
+}
+
+
+
+
+
+
+// ////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// MEMORY TRACKER
+// 
+
+OculusVROpenGLWidget::OVRMemoryTracker::OVRMemoryTracker() :
+	m_totalUsage(0),
+	m_budget(0),
+	m_warningRatio(0.9)
+{
+	for (int i = 0; i < CategoryCount; ++i)
+	{
+		m_usage[i] = 0;
+		m_counts[i] = 0;
+	}
+}
+
+void OculusVROpenGLWidget::OVRMemoryTracker::Reserve(qint64 bytes)
+{
+	// Warn before allocating, so that the client can release memory first
+	qint64 usage = m_totalUsage + bytes;
+	qint64 threshold = qint64(m_budget * m_warningRatio);
+	if (m_budget > 0 && bytes > 0 && usage > threshold && m_budgetCallback)
+		m_budgetCallback(usage, m_budget);
+}
+
+void OculusVROpenGLWidget::OVRMemoryTracker::Track(Category category, quint64 id, qint64 bytes)
+{
+	QPair<int, quint64> key(category, id);
+	qint64 previous = m_allocations.value(key, -1);
+	if (previous < 0)
+	{
+		m_counts[category]++;
+		previous = 0;
+	}
+
+	m_allocations.insert(key, bytes);
+	m_usage[category] += bytes - previous;
+	m_totalUsage += bytes - previous;
+}
+
+void OculusVROpenGLWidget::OVRMemoryTracker::Untrack(Category category, quint64 id)
+{
+	QPair<int, quint64> key(category, id);
+	if (!m_allocations.contains(key))
+		return;
+
+	qint64 bytes = m_allocations.take(key);
+	m_counts[category]--;
+	m_usage[category] -= bytes;
+	m_totalUsage -= bytes;
+}
+
+qint64 OculusVROpenGLWidget::OVRMemoryTracker::GetUsage(Category category) const
+{
+	return m_usage[category];
+}
+
+int OculusVROpenGLWidget::OVRMemoryTracker::GetCount(Category category) const
+{
+	return m_counts[category];
+}
+
+qint64 OculusVROpenGLWidget::OVRMemoryTracker::GetTotalUsage() const
+{
+	return m_totalUsage;
+}
+
+void OculusVROpenGLWidget::OVRMemoryTracker::SetBudget(qint64 bytes, double warningRatio)
+{
+	m_budget = bytes;
+	m_warningRatio = warningRatio;
+}
+
+qint64 OculusVROpenGLWidget::OVRMemoryTracker::GetBudget() const
+{
+	return m_budget;
+}
+
+void OculusVROpenGLWidget::OVRMemoryTracker::SetBudgetCallback(std::function<void(qint64, qint64)> callback)
+{
+	m_budgetCallback = callback;
+}
+
+
+
+
+
+
+// ////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CAMERA RIG
+// 
+
+// Lanes of the batched computation: 8 views with AVX, 4 with SSE, 4 scalar otherwise
+#if defined(OVR_CAMERA_RIG_AVX)
+
+struct Lanes { __m256 v; };
+static const int s_laneCount = 8;
+static inline Lanes LanesLoad(const float* p) { Lanes r = { _mm256_loadu_ps(p) }; return r; }
+static inline void LanesStore(float* p, Lanes a) { _mm256_storeu_ps(p, a.v); }
+static inline Lanes LanesSet(float f) { Lanes r = { _mm256_set1_ps(f) }; return r; }
+static inline Lanes operator+(Lanes a, Lanes b) { Lanes r = { _mm256_add_ps(a.v, b.v) }; return r; }
+static inline Lanes operator-(Lanes a, Lanes b) { Lanes r = { _mm256_sub_ps(a.v, b.v) }; return r; }
+static inline Lanes operator*(Lanes a, Lanes b) { Lanes r = { _mm256_mul_ps(a.v, b.v) }; return r; }
+
+#elif defined(OVR_CAMERA_RIG_SSE)
+
+struct Lanes { __m128 v; };
+static const int s_laneCount = 4;
+static inline Lanes LanesLoad(const float* p) { Lanes r = { _mm_loadu_ps(p) }; return r; }
+static inline void LanesStore(float* p, Lanes a) { _mm_storeu_ps(p, a.v); }
+static inline Lanes LanesSet(float f) { Lanes r = { _mm_set1_ps(f) }; return r; }
+static inline Lanes operator+(Lanes a, Lanes b) { Lanes r = { _mm_add_ps(a.v, b.v) }; return r; }
+static inline Lanes operator-(Lanes a, Lanes b) { Lanes r = { _mm_sub_ps(a.v, b.v) }; return r; }
+static inline Lanes operator*(Lanes a, Lanes b) { Lanes r = { _mm_mul_ps(a.v, b.v) }; return r; }
+
+#else
+
+struct Lanes { float v[4]; };
+static const int s_laneCount = 4;
+static inline Lanes LanesLoad(const float* p) { Lanes r; for (int i = 0; i < 4; ++i) r.v[i] = p[i]; return r; }
+static inline void LanesStore(float* p, Lanes a) { for (int i = 0; i < 4; ++i) p[i] = a.v[i]; }
+static inline Lanes LanesSet(float f) { Lanes r; for (int i = 0; i < 4; ++i) r.v[i] = f; return r; }
+static inline Lanes operator+(Lanes a, Lanes b) { for (int i = 0; i < 4; ++i) a.v[i] += b.v[i]; return a; }
+static inline Lanes operator-(Lanes a, Lanes b) { for (int i = 0; i < 4; ++i) a.v[i] -= b.v[i]; return a; }
+static inline Lanes operator*(Lanes a, Lanes b) { for (int i = 0; i < 4; ++i) a.v[i] *= b.v[i]; return a; }
+
+#endif
+
+OculusVROpenGLWidget::OVRCameraRig::OVRCameraRig() :
+	m_count(0),
+	m_capacity(0)
+{
+}
+
+float* OculusVROpenGLWidget::OVRCameraRig::FieldData(int field)
+{
+	return m_fields.data() + field * m_capacity;
+}
+
+const float* OculusVROpenGLWidget::OVRCameraRig::FieldData(int field) const
+{
+	return m_fields.constData() + field * m_capacity;
+}
+
+int OculusVROpenGLWidget::OVRCameraRig::AddView()
+{
+	if (m_count == m_capacity)
+	{
+		// Grow by a full set of lanes, initialized with identity rigs, poses and projections
+		int capacity = m_capacity + s_laneCount;
+		QVector<float> fields(FieldCount * capacity, 0.0f);
+		for (int field = 0; field < FieldCount; ++field)
+		{
+			float* data = fields.data() + field * capacity;
+			for (int i = 0; i < m_capacity; ++i)
+				data[i] = FieldData(field)[i];
+			for (int i = m_capacity; i < capacity; ++i)
+			{
+				bool one = field == CosYaw || field == CosPitch || field == CosRoll || field == OrientationW ||
+					field == Projection + 0 || field == Projection + 5 || field == Projection + 10 || field == Projection + 15;
+				data[i] = one ? 1.0f : 0.0f;
+			}
+		}
+		m_fields = fields;
+		m_capacity = capacity;
+	}
+
+	Fov fov = {};
+	m_rotations.append(Vector3f());
+	m_fovs.append(fov);
+	m_dirty.append(true);
+	return m_count++;
+}
+
+int OculusVROpenGLWidget::OVRCameraRig::GetViewCount() const
+{
+	return m_count;
+}
+
+void OculusVROpenGLWidget::OVRCameraRig::SetRig(int view, const Vector3f& translation, const Vector3f& rotations)
+{
+	float* translationX = FieldData(TranslationX);
+	float* translationY = FieldData(TranslationY);
+	float* translationZ = FieldData(TranslationZ);
+	if (translationX[view] != translation.x || translationY[view] != translation.y || translationZ[view] != translation.z)
+	{
+		translationX[view] = translation.x;
+		translationY[view] = translation.y;
+		translationZ[view] = translation.z;
+		m_dirty[view] = true;
+	}
+
+	// Sines and cosines are only computed when the angles change
+	Vector3f& previous = m_rotations[view];
+	if (previous.x != rotations.x || previous.y != rotations.y || previous.z != rotations.z)
+	{
+		previous = rotations;
+		FieldData(CosYaw)[view] = cosf(rotations[_YAW]);
+		FieldData(SinYaw)[view] = sinf(rotations[_YAW]);
+		FieldData(CosPitch)[view] = cosf(rotations[_PITCH]);
+		FieldData(SinPitch)[view] = sinf(rotations[_PITCH]);
+		FieldData(CosRoll)[view] = cosf(rotations[_ROLL]);
+		FieldData(SinRoll)[view] = sinf(rotations[_ROLL]);
+		m_dirty[view] = true;
+	}
+}
+
+void OculusVROpenGLWidget::OVRCameraRig::SetPose(int view, const Quatf& orientation, const Vector3f& position)
+{
+	float values[7] = { orientation.x, orientation.y, orientation.z, orientation.w, position.x, position.y, position.z };
+	for (int i = 0; i < 7; ++i)
+	{
+		float& value = FieldData(OrientationX + i)[view];
+		if (value != values[i])
+		{
+			value = values[i];
+			m_dirty[view] = true;
+		}
+	}
+}
+
+void OculusVROpenGLWidget::OVRCameraRig::SetFov(int view, const ovrFovPort& fov, float zNear, float zFar)
+{
+	// The projection is only computed when the field of view or the planes change
+	Fov& previous = m_fovs[view];
+	if (previous.valid && previous.zNear == zNear && previous.zFar == zFar &&
+		previous.port.UpTan == fov.UpTan && previous.port.DownTan == fov.DownTan &&
+		previous.port.LeftTan == fov.LeftTan && previous.port.RightTan == fov.RightTan)
+		return;
+
+	SetProjection(view, ovrMatrix4f_Projection(fov, zNear, zFar, ovrProjection_None));
+
+	previous.port = fov;
+	previous.zNear = zNear;
+	previous.zFar = zFar;
+	previous.valid = true;
+}
+
+void OculusVROpenGLWidget::OVRCameraRig::SetProjection(int view, const Matrix4f& projection)
+{
+	m_fovs[view].valid = false;
+
+	for (int i = 0; i < 16; ++i)
+	{
+		float& value = FieldData(Projection + i)[view];
+		if (value != projection.M[i / 4][i % 4])
+		{
+			value = projection.M[i / 4][i % 4];
+			m_dirty[view] = true;
+		}
+	}
+}
+
+void OculusVROpenGLWidget::OVRCameraRig::Update()
+{
+	for (int first = 0; first < m_count; first += s_laneCount)
+	{
+		bool dirty = false;
+		for (int view = first; view < first + s_laneCount && view < m_count; ++view)
+		{
+			dirty = dirty || m_dirty[view];
+			m_dirty[view] = false;
+		}
+
+		if (dirty)
+			UpdateLanes(first);
+	}
+}
+
+void OculusVROpenGLWidget::OVRCameraRig::UpdateLanes(int first)
+{
+	Lanes two = LanesSet(2.0f);
+
+	// Rig rotation: RotationZ(roll) * RotationX(pitch) * RotationY(yaw)
+	Lanes cy = LanesLoad(FieldData(CosYaw) + first);
+	Lanes sy = LanesLoad(FieldData(SinYaw) + first);
+	Lanes cp = LanesLoad(FieldData(CosPitch) + first);
+	Lanes sp = LanesLoad(FieldData(SinPitch) + first);
+	Lanes cr = LanesLoad(FieldData(CosRoll) + first);
+	Lanes sr = LanesLoad(FieldData(SinRoll) + first);
+
+	Lanes r[3][3];
+	r[0][0] = cr * cy - sr * sp * sy;
+	r[0][1] = LanesSet(0.0f) - sr * cp;
+	r[0][2] = cr * sy + sr * sp * cy;
+	r[1][0] = sr * cy + cr * sp * sy;
+	r[1][1] = cr * cp;
+	r[1][2] = sr * sy - cr * sp * cy;
+	r[2][0] = LanesSet(0.0f) - cp * sy;
+	r[2][1] = sp;
+	r[2][2] = cp * cy;
+
+	// Pose orientation, as Matrix4f(Quatf)
+	Lanes x = LanesLoad(FieldData(OrientationX) + first);
+	Lanes y = LanesLoad(FieldData(OrientationY) + first);
+	Lanes z = LanesLoad(FieldData(OrientationZ) + first);
+	Lanes w = LanesLoad(FieldData(OrientationW) + first);
+	Lanes ww = w * w, xx = x * x, yy = y * y, zz = z * z;
+
+	Lanes q[3][3];
+	q[0][0] = ww + xx - yy - zz;
+	q[0][1] = two * (x * y - w * z);
+	q[0][2] = two * (x * z + w * y);
+	q[1][0] = two * (x * y + w * z);
+	q[1][1] = ww - xx + yy - zz;
+	q[1][2] = two * (y * z - w * x);
+	q[2][0] = two * (x * z - w * y);
+	q[2][1] = two * (y * z + w * x);
+	q[2][2] = ww - xx - yy + zz;
+
+	// Final orientation and world position
+	Lanes f[3][3];
+	for (int i = 0; i < 3; ++i)
+	{
+		for (int j = 0; j < 3; ++j)
+			f[i][j] = r[i][0] * q[0][j] + r[i][1] * q[1][j] + r[i][2] * q[2][j];
+	}
+
+	Lanes pose[3] = {
+		LanesLoad(FieldData(PoseX) + first),
+		LanesLoad(FieldData(PoseY) + first),
+		LanesLoad(FieldData(PoseZ) + first) };
+	Lanes position[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		position[i] = LanesLoad(FieldData(TranslationX + i) + first) +
+			r[i][0] * pose[0] + r[i][1] * pose[1] + r[i][2] * pose[2];
+		LanesStore(FieldData(PositionX + i) + first, position[i]);
+	}
+
+	// LookAtRH(position, position + f * (0, 0, -1), f * (0, 1, 0)): rows are the columns of f
+	Lanes v[3][4];
+	for (int i = 0; i < 3; ++i)
+	{
+		for (int j = 0; j < 3; ++j)
+		{
+			v[i][j] = f[j][i];
+			LanesStore(FieldData(View + i * 4 + j) + first, v[i][j]);
+		}
+		v[i][3] = LanesSet(0.0f) - (f[0][i] * position[0] + f[1][i] * position[1] + f[2][i] * position[2]);
+		LanesStore(FieldData(View + i * 4 + 3) + first, v[i][3]);
+	}
+
+	// Projection * view, the last view row being (0, 0, 0, 1)
+	for (int i = 0; i < 4; ++i)
+	{
+		Lanes p[4];
+		for (int k = 0; k < 4; ++k)
+			p[k] = LanesLoad(FieldData(Projection + i * 4 + k) + first);
+
+		for (int j = 0; j < 4; ++j)
+		{
+			Lanes value = p[0] * v[0][j] + p[1] * v[1][j] + p[2] * v[2][j];
+			if (j == 3)
+				value = value + p[3];
+			LanesStore(FieldData(ViewProjection + i * 4 + j) + first, value);
+		}
+	}
+}
+
+Matrix4f OculusVROpenGLWidget::OVRCameraRig::GetView(int view) const
+{
+	Matrix4f m;
+	for (int i = 0; i < 12; ++i)
+		m.M[i / 4][i % 4] = FieldData(View + i)[view];
+	return m;
+}
+
+Matrix4f OculusVROpenGLWidget::OVRCameraRig::GetProjection(int view) const
+{
+	Matrix4f m;
+	for (int i = 0; i < 16; ++i)
+		m.M[i / 4][i % 4] = FieldData(Projection + i)[view];
+	return m;
+}
+
+Matrix4f OculusVROpenGLWidget::OVRCameraRig::GetViewProjection(int view) const
+{
+	Matrix4f m;
+	for (int i = 0; i < 16; ++i)
+		m.M[i / 4][i % 4] = FieldData(ViewProjection + i)[view];
+	return m;
+}
+
+Vector3f OculusVROpenGLWidget::OVRCameraRig::GetPosition(int view) const
+{
+	return Vector3f(FieldData(PositionX)[view], FieldData(PositionY)[view], FieldData(PositionZ)[view]);
+}
+
+void OculusVROpenGLWidget::OVRCameraRig::ComputeScalar(const Vector3f& translation, const Vector3f& rotations, const Quatf& orientation, const Vector3f& position,
+	const ovrFovPort& fov, float zNear, float zFar, Matrix4f& view, Matrix4f& viewProjection)
+{
+	Matrix4f rollPitchYaw =
+		Matrix4f::RotationZ(rotations[_ROLL]) *
+		Matrix4f::RotationX(rotations[_PITCH]) *
+		Matrix4f::RotationY(rotations[_YAW]);
+
+	Matrix4f finalRollPitchYaw = rollPitchYaw * Matrix4f(orientation);
+	Vector3f finalUp = finalRollPitchYaw.Transform(Vector3f(0, 1, 0));
+	Vector3f finalForward = finalRollPitchYaw.Transform(Vector3f(0, 0, -1));
+	Vector3f shiftedEyePos = translation + rollPitchYaw.Transform(position);
+
+	view = Matrix4f::LookAtRH(shiftedEyePos, shiftedEyePos + finalForward, finalUp);
+	viewProjection = Matrix4f(ovrMatrix4f_Projection(fov, zNear, zFar, ovrProjection_None)) * view;
+}
+
+OculusVROpenGLWidget::OVRCameraRig::BenchmarkResult OculusVROpenGLWidget::OVRCameraRig::Benchmark(int viewCount, int iterations)
+{
+	// Reproducible inputs in [-1, 1]
+	quint32 seed = 1;
+	auto random = [&seed]() {
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) * (2.0f / 16777216.0f) - 1.0f;
+	};
+
+	ovrFovPort fov;
+	fov.UpTan = 1.3f;
+	fov.DownTan = 1.3f;
+	fov.LeftTan = 1.1f;
+	fov.RightTan = 1.0f;
+
+	OVRCameraRig rig;
+	QVector<Vector3f> translations, rotations, positions;
+	QVector<Quatf> orientations;
+	for (int view = 0; view < viewCount; ++view)
+	{
+		translations.append(Vector3f(random(), random(), random()) * 5.0f);
+		rotations.append(Vector3f(random() * 3.0f, random() * 1.5f, random()));
+		orientations.append(Quatf(random(), random(), random(), random()).Normalized());
+		positions.append(Vector3f(random(), random() + 1.6f, random()));
+
+		rig.AddView();
+		rig.SetRig(view, translations[view], rotations[view]);
+		rig.SetPose(view, orientations[view], positions[view]);
+		rig.SetFov(view, fov, 0.2f, 1000.0f);
+	}
+
+	BenchmarkResult result = {};
+	result.viewCount = viewCount;
+	if (viewCount <= 0 || iterations <= 0)
+		return result;
+
+	// Accuracy: the projection * view coefficients are compared relatively to their magnitude
+	rig.Update();
+	for (int view = 0; view < viewCount; ++view)
+	{
+		Matrix4f scalarView, scalarViewProjection;
+		ComputeScalar(translations[view], rotations[view], orientations[view], positions[view], fov, 0.2f, 1000.0f, scalarView, scalarViewProjection);
+
+		Matrix4f batchedView = rig.GetView(view);
+		Matrix4f batchedViewProjection = rig.GetViewProjection(view);
+		for (int i = 0; i < 16; ++i)
+		{
+			float reference = scalarViewProjection.M[i / 4][i % 4];
+			float viewError = fabsf(batchedView.M[i / 4][i % 4] - scalarView.M[i / 4][i % 4]);
+			float viewProjectionError = fabsf(batchedViewProjection.M[i / 4][i % 4] - reference) / qMax(1.0f, fabsf(reference));
+			result.maxError = qMax(result.maxError, qMax(viewError, viewProjectionError));
+		}
+	}
+
+	// Timing: the poses move at each iteration, as the tracking poses do each frame
+	volatile float sink = 0.0f;
+	QElapsedTimer timer;
+
+	timer.start();
+	for (int iteration = 0; iteration < iterations; ++iteration)
+	{
+		Vector3f offset(0.01f * (iteration & 1), 0.0f, 0.0f);
+		for (int view = 0; view < viewCount; ++view)
+		{
+			Matrix4f scalarView, scalarViewProjection;
+			ComputeScalar(translations[view], rotations[view], orientations[view], positions[view] + offset, fov, 0.2f, 1000.0f, scalarView, scalarViewProjection);
+			sink = sink + scalarViewProjection.M[0][0];
+		}
+	}
+	result.scalarTime = double(timer.nsecsElapsed()) / (double(iterations) * viewCount);
+
+	timer.start();
+	for (int iteration = 0; iteration < iterations; ++iteration)
+	{
+		Vector3f offset(0.01f * (iteration & 1), 0.0f, 0.0f);
+		for (int view = 0; view < viewCount; ++view)
+		{
+			rig.SetRig(view, translations[view], rotations[view]);
+			rig.SetPose(view, orientations[view], positions[view] + offset);
+			rig.SetFov(view, fov, 0.2f, 1000.0f);
+		}
+		rig.Update();
+		sink = sink + rig.FieldData(ViewProjection)[0];
+	}
+	result.batchedTime = double(timer.nsecsElapsed()) / (double(iterations) * viewCount);
+
+	return result;
+}
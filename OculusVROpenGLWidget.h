@@ -12,6 +12,15 @@
 #include <QOpenGLWidget>
 #include <QOpenGLFunctions_4_5_core>
 #include <QTimer>
+#include <QVector>
+#include <QByteArray>
+#include <QMap>
+#include <QString>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QPair>
+
+#include <functional>
 
 using namespace OVR;
 
@@ -29,6 +38,18 @@ using namespace OVR;
 #define _PITCH	1
 #define _ROLL	2
 
+/// Shader storage binding of the instances model matrices of an OVRIndirectScene
+#define OVR_SCENE_INSTANCE_BINDING	0
+
+/// Size in pixels of the eye texture cells warped by the reprojection preview
+#define OVR_REPROJECTION_GRID_STEP	4
+
+/// Maximum number of frames the GPU may process while the CPU prepares the next one
+#define OVR_MAX_FRAMES_IN_FLIGHT	3
+
+/// Default size in bytes of the per frame allocator
+#define OVR_FRAME_ALLOCATOR_SIZE	(4 * 1024 * 1024)
+
 /// \class OculusVROpenGLWidget
 /// \brief Define a widget which renders a scene in the Oculus headset and in the widget on demand.
 /// It is mostly inspired by the Oculus Tiny Room (GL) sample from Oculus SDK.
@@ -40,6 +61,95 @@ class OculusVROpenGLWidget :
 
 public:
 
+	/// Widget preview modes
+	enum PreviewMode {
+		/// Render the scene again with the eyes poses
+		PreviewRender,
+		/// Reproject the last eyes textures to the spectator camera
+		PreviewReprojection
+	};
+
+	/// \class OVRMemoryTracker
+	/// \brief Define an accounting of the GPU memory allocated by the widget helpers and the client.
+	/// Each allocation is identified by its category and its ID (OpenGL name or swap chain handle).
+	/// Reserve() is called before an allocation: when it would bring the total above the warning ratio
+	/// of the budget, the budget callback is called before the memory is allocated, so that caches can
+	/// be evicted. Track() then records the allocation once its ID is known.
+	class OVRMemoryTracker
+	{
+	public:
+		/// Allocations categories
+		enum Category {
+			SwapChains,
+			Framebuffers,
+			Buffers,
+			Textures,
+			CategoryCount
+		};
+
+		/// Constructor
+		OVRMemoryTracker();
+
+		/// Check the budget before an allocation, and call the budget callback if needed.
+		/// \param bytes Size in bytes of the allocation to come.
+		void Reserve(qint64 bytes);
+
+		/// Record an allocation, or its new size if the ID is already tracked.
+		/// \param category Allocation category.
+		/// \param id OpenGL name or swap chain handle.
+		/// \param bytes Allocated size in bytes.
+		/// \note The budget is checked by Reserve(), before the allocation.
+		void Track(Category category, quint64 id, qint64 bytes);
+
+		/// Forget an allocation.
+		/// \param category Allocation category.
+		/// \param id OpenGL name or swap chain handle.
+		void Untrack(Category category, quint64 id);
+
+		/// \return The bytes allocated in a category.
+		qint64 GetUsage(Category category) const;
+
+		/// \return The number of allocations in a category.
+		int GetCount(Category category) const;
+
+		/// \return The bytes allocated in all categories.
+		qint64 GetTotalUsage() const;
+
+		/// Set the memory budget.
+		/// \param bytes Budget in bytes, 0 for no budget.
+		/// \param warningRatio Part of the budget above which the budget callback is called.
+		void SetBudget(qint64 bytes, double warningRatio = 0.9);
+
+		/// \return The memory budget in bytes, 0 for no budget.
+		qint64 GetBudget() const;
+
+		/// Set the function called by Reserve() when an allocation would go above the warning ratio of the budget.
+		/// \param callback Called with the total usage including the allocation, and the budget.
+		void SetBudgetCallback(std::function<void(qint64, qint64)> callback);
+
+	private:
+		/// Allocations sizes by category and ID
+		QHash<QPair<int, quint64>, qint64> m_allocations;
+
+		/// Bytes by category
+		qint64 m_usage[CategoryCount];
+
+		/// Allocations count by category
+		int m_counts[CategoryCount];
+
+		/// Bytes in all categories
+		qint64 m_totalUsage;
+
+		/// Budget in bytes
+		qint64 m_budget;
+
+		/// Part of the budget above which the callback is called
+		double m_warningRatio;
+
+		/// Budget callback
+		std::function<void(qint64, qint64)> m_budgetCallback;
+	};
+
 	/// \class OculusTextureBuffer
 	/// \brief Define buffers for eyes textures handling.
 	class OVRTexBuffer : public QOpenGLFunctions_4_5_Core
@@ -57,14 +167,24 @@ public:
 		/// Corresponding frame buffer object ID
 		GLuint m_fboId;
 
+		/// Color texture ID of the last rendered frame
+		GLuint m_lastColorTexId;
+
+		/// Depth texture ID of the last rendered frame
+		GLuint m_lastDepthTexId;
+
 		/// Conresponding texture size
 		Sizei m_texSize;
 
+		/// Accounting of the swap chains and frame buffer, may be nullptr
+		OVRMemoryTracker* m_memoryTracker;
+
 		/// Constructor
 		/// \param session Running oculus session
 		/// \param size Texture size.
 		/// \param sampleCount
-		OVRTexBuffer(ovrSession session, Sizei size, int sampleCount);
+		/// \param memoryTracker Accounting of the swap chains and frame buffer, nullptr to leave them untracked.
+		OVRTexBuffer(ovrSession session, Sizei size, int sampleCount, OVRMemoryTracker* memoryTracker);
 
 		/// Destructor
 		~OVRTexBuffer();
@@ -82,6 +202,626 @@ public:
 		void Commit();
 	};
 
+	/// \class OVRIndirectScene
+	/// \brief Define a scene drawn with one multi draw indirect call per eye.
+	/// Meshes share one vertex buffer and one index buffer, instances are stored in shader storage
+	/// buffers and a compute shader culls them against the eye frustum to write the draw commands.
+	/// The client vertex shader gets the instance index from the attribute given to the constructor
+	/// and reads its model matrix from:
+	/// layout(std430, binding = OVR_SCENE_INSTANCE_BINDING) readonly buffer Instances { mat4 models[]; };
+	class OVRIndirectScene : public QOpenGLFunctions_4_5_Core
+	{
+	public:
+		/// Constructor
+		/// \param vertexStride Size in bytes of one vertex.
+		/// \param instanceLocation Vertex attribute location of the instance index.
+		/// \param memoryTracker Accounting of the buffers, MemoryTracker() of the widget for example, nullptr to leave them untracked.
+		/// \note Must be called with a current OpenGL context (in InitializeRendering() for example).
+		OVRIndirectScene(GLsizei vertexStride, GLuint instanceLocation, OVRMemoryTracker* memoryTracker);
+
+		/// Destructor
+		~OVRIndirectScene();
+
+		/// Declare a float vertex attribute.
+		/// \param location Vertex attribute location.
+		/// \param size Number of components.
+		/// \param type Components type (GL_FLOAT, GL_UNSIGNED_BYTE...).
+		/// \param offset Offset in bytes in the vertex.
+		/// \param normalized Normalization of integer components.
+		void SetVertexAttribute(GLuint location, GLint size, GLenum type, GLuint offset, bool normalized = false);
+
+		/// Add a mesh to the shared buffers.
+		/// \param vertices Vertices data (vertexCount * vertexStride bytes).
+		/// \param vertexCount Number of vertices.
+		/// \param indices Triangles indices, relative to the first vertex of the mesh.
+		/// \param indexCount Number of indices.
+		/// \param center Center of the mesh bounding sphere.
+		/// \param radius Radius of the mesh bounding sphere.
+		/// \return The mesh ID.
+		int AddMesh(const void* vertices, int vertexCount, const GLuint* indices, int indexCount, Vector3f center, float radius);
+
+		/// Add an instance of a mesh.
+		/// \param meshId Mesh ID returned by AddMesh().
+		/// \param model Model matrix of the instance.
+		/// \return The instance ID, used as index in the models shader storage buffer, -1 if the mesh ID is invalid.
+		int AddInstance(int meshId, const Matrix4f& model);
+
+		/// Move an instance. The modified models are uploaded together by the next Cull() or DrawUnbatched().
+		/// \param instanceId Instance ID returned by AddInstance(), invalid IDs are ignored.
+		/// \param model New model matrix of the instance.
+		void SetInstanceModel(int instanceId, const Matrix4f& model);
+
+		/// \return The number of instances.
+		int GetInstanceCount() const;
+
+		/// Cull instances against a frustum and write the draw commands.
+		/// \param viewProj The projection * view matrix of the eye.
+		/// \note Changes the current program: call it before binding the client program.
+		void Cull(const Matrix4f& viewProj);
+
+		/// Draw the instances kept by the last Cull() call.
+		/// \note The client program must be bound.
+		void Draw();
+
+		/// Draw every instance with its own draw call and without culling, the baseline of Draw().
+		/// \note The client program must be bound.
+		void DrawUnbatched();
+
+		/// Create a benchmark scene: instances of a few spheres and boxes on a cubic grid centered on the origin.
+		/// Vertices are a position (location 0) and a normal (location 1), the instance index is at location 2.
+		/// \param instanceCount Number of instances, 10000 to 100000 for example.
+		/// \param memoryTracker Accounting of the buffers, MemoryTracker() of the widget for example, nullptr to leave them untracked.
+		/// \param spacing Distance between two instances of the grid.
+		/// \return The scene, owned by the client.
+		/// \note Must be called with a current OpenGL context.
+		static OVRIndirectScene* CreateBenchmarkScene(int instanceCount, OVRMemoryTracker* memoryTracker, float spacing = 2.0f);
+
+		/// \return The shaders sources drawing the benchmark scene, to give to OVRProgramCache::LoadProgram().
+		/// The projection * view matrix is set with the u_viewProj uniform.
+		static QMap<GLenum, QByteArray> GetBenchmarkProgramSources();
+
+	private:
+		/// Mesh description, laid out as in the cull shader (std430)
+		struct Mesh
+		{
+			float center[3];
+			float radius;
+			GLuint indexCount;
+			GLuint firstIndex;
+			GLint baseVertex;
+			GLuint padding;
+		};
+
+		/// Function pointer to glMultiDrawElementsIndirectCount (OpenGL 4.6 or GL_ARB_indirect_parameters)
+		typedef void (QOPENGLF_APIENTRYP MultiDrawElementsIndirectCount)(GLenum mode, GLenum type, const void *indirect, GLintptr drawcount, GLsizei maxdrawcount, GLsizei stride);
+
+		/// Upload the modified CPU data to the GPU buffers.
+		void Upload();
+
+		/// \return A new tracked buffer.
+		GLuint CreateBuffer(GLsizeiptr size, const void* data, GLenum usage);
+
+		/// Delete a tracked buffer and reset its name.
+		void DeleteBuffer(GLuint& buffer);
+
+		/// Accounting of the buffers, may be nullptr
+		OVRMemoryTracker* m_memoryTracker;
+
+		/// Size in bytes of one vertex
+		GLsizei m_vertexStride;
+
+		/// Vertex attribute location of the instance index
+		GLuint m_instanceLocation;
+
+		/// Vertices of all meshes
+		QByteArray m_vertices;
+
+		/// Indices of all meshes
+		QVector<GLuint> m_indices;
+
+		/// Meshes descriptions
+		QVector<Mesh> m_meshes;
+
+		/// Instances model matrices, transposed to be read as GLSL mat4
+		QVector<Matrix4f> m_models;
+
+		/// Mesh ID of each instance
+		QVector<GLuint> m_instanceMeshes;
+
+		/// Geometry modification status since last upload
+		bool m_geometryDirty;
+
+		/// Instances modification status since last upload
+		bool m_instancesDirty;
+
+		/// Number of instances in the GPU buffers
+		int m_uploadedInstances;
+
+		/// First model modified since last upload
+		int m_dirtyModelsBegin;
+
+		/// End of the models modified since last upload
+		int m_dirtyModelsEnd;
+
+		/// Vertex array object
+		GLuint m_vao;
+
+		/// Shared vertex buffer
+		GLuint m_vertexBuffer;
+
+		/// Shared index buffer
+		GLuint m_indexBuffer;
+
+		/// Meshes descriptions buffer
+		GLuint m_meshBuffer;
+
+		/// Instances model matrices buffer
+		GLuint m_modelBuffer;
+
+		/// Instances mesh ID buffer
+		GLuint m_instanceMeshBuffer;
+
+		/// Instance indices buffer (one per instance, read with the base instance of each command)
+		GLuint m_instanceIdBuffer;
+
+		/// DrawElementsIndirectCommand buffer
+		GLuint m_commandBuffer;
+
+		/// Draw count buffer
+		GLuint m_parameterBuffer;
+
+		/// Cull compute program
+		GLuint m_cullProgram;
+
+		/// Frustum planes uniform location
+		GLint m_planesLocation;
+
+		/// Instance count uniform location
+		GLint m_instanceCountLocation;
+
+		/// glMultiDrawElementsIndirectCount, nullptr if not supported
+		MultiDrawElementsIndirectCount m_multiDrawElementsIndirectCount;
+	};
+
+	/// \class OVRProgramCache
+	/// \brief Define a disk cache of linked programs binaries.
+	/// Binaries are keyed by the shaders sources and the driver vendor, renderer and version.
+	/// Cache misses are compiled in background threads when GL_KHR_parallel_shader_compile is supported.
+	class OVRProgramCache : public QOpenGLFunctions_4_5_Core
+	{
+	public:
+		/// Cache statistics, for startup benchmarking
+		struct Statistics
+		{
+			/// Programs loaded from a binary
+			int hits;
+
+			/// Programs compiled from sources
+			int misses;
+
+			/// Binaries rejected by the driver (counted in misses too)
+			int rejected;
+
+			/// Time spent loading binaries, in milliseconds
+			double loadTime;
+
+			/// Time spent waiting for compilations, in milliseconds
+			double compileTime;
+		};
+
+		/// Constructor
+		/// \param directory Directory of the binaries files.
+		/// \note Must be called with a current OpenGL context.
+		OVRProgramCache(const QString& directory);
+
+		/// Destructor
+		/// \note Programs are owned by the client, they are not deleted.
+		~OVRProgramCache();
+
+		/// Get a program from the cache or build it.
+		/// \param sources Shaders sources by stage (GL_VERTEX_SHADER, GL_FRAGMENT_SHADER...).
+		/// \return The program ID. A cache miss may still be compiling: call IsReady() or Finish() before use.
+		GLuint LoadProgram(const QMap<GLenum, QByteArray>& sources);
+
+		/// \return True if the program is linked, and stores its binary once linked.
+		bool IsReady(GLuint program);
+
+		/// Wait for all the pending compilations and store their binaries.
+		void Finish();
+
+		/// \return The cache statistics.
+		Statistics GetStatistics() const;
+
+	private:
+		/// Program being compiled
+		struct Pending
+		{
+			GLuint program;
+			QByteArray key;
+			QVector<GLuint> shaders;
+		};
+
+		/// Function pointer to glMaxShaderCompilerThreadsKHR
+		typedef void (QOPENGLF_APIENTRYP MaxShaderCompilerThreads)(GLuint count);
+
+		/// \return The cache key of the sources for the running driver.
+		QByteArray Key(const QMap<GLenum, QByteArray>& sources) const;
+
+		/// \return The binary file path of a key.
+		QString FilePath(const QByteArray& key) const;
+
+		/// Check the link of a pending program and store its binary.
+		void Complete(int pendingIndex);
+
+		/// Binaries directory
+		QString m_directory;
+
+		/// Driver description, part of the keys
+		QByteArray m_driver;
+
+		/// Binaries support (at least one binary format)
+		bool m_binarySupported;
+
+		/// GL_KHR_parallel_shader_compile support
+		bool m_parallelCompile;
+
+		/// Programs being compiled
+		QVector<Pending> m_pending;
+
+		/// Statistics
+		Statistics m_statistics;
+	};
+
+	/// \class OVRFrameAllocator
+	/// \brief Define a linear allocator of per frame data in a persistently mapped buffer.
+	/// Allocations are valid until the end of the frame: the memory is reused once the GPU
+	/// has finished the frame which used it.
+	class OVRFrameAllocator
+	{
+	public:
+		/// Allocated memory
+		struct Allocation
+		{
+			/// Pointer to write the data, nullptr if the allocator is full
+			void* data;
+
+			/// OpenGL buffer containing the data
+			GLuint buffer;
+
+			/// Offset of the data in the buffer
+			GLintptr offset;
+		};
+
+		/// Constructor
+		OVRFrameAllocator();
+
+		/// Allocate memory for the current frame.
+		/// \param size Size in bytes.
+		/// \param alignment Alignment of the offset in the buffer (256 fits uniform buffers).
+		/// \return The allocation, with a null data pointer if the frame memory is exhausted.
+		Allocation Allocate(GLsizeiptr size, GLsizeiptr alignment = 256);
+
+		/// \return The size in bytes allocated during the current frame.
+		GLsizeiptr GetUsedSize() const;
+
+		/// \return The size in bytes available for a frame.
+		GLsizeiptr GetCapacity() const;
+
+		/// Restart the allocations in a buffer region.
+		/// \note Called by the widget when the GPU no longer reads the region.
+		void Reset(GLuint buffer, GLintptr offset, GLsizeiptr capacity, char* data);
+
+	private:
+		/// Buffer of the region
+		GLuint m_buffer;
+
+		/// Offset of the region in the buffer
+		GLintptr m_offset;
+
+		/// Size of the region
+		GLsizeiptr m_capacity;
+
+		/// Used size of the region
+		GLsizeiptr m_used;
+
+		/// Mapped region
+		char* m_data;
+	};
+
+	/// \class OVROcclusionCuller
+	/// \brief Define an occlusion culling of objects bounding spheres shared by both eyes.
+	/// Each headset frame, a hierarchical depth buffer (Hi-Z) is built from the depth of the previous
+	/// frame left eye, and one compute dispatch tests all the objects for both eyes: against the Hi-Z,
+	/// with spheres enlarged by the eyes distance, then against each eye frustum.
+	/// The visibility bitmasks are available on the GPU for the current frame, and on the CPU
+	/// as soon as the GPU has finished the frame which computed them (usually one frame later).
+	class OVROcclusionCuller : public QOpenGLFunctions_4_5_Core
+	{
+	public:
+		/// Constructor
+		/// \param programCache Cache of the culling programs.
+		/// \param memoryTracker Accounting of the Hi-Z texture and the buffers, nullptr to leave them untracked.
+		/// \note Must be called with a current OpenGL context.
+		OVROcclusionCuller(OVRProgramCache* programCache, OVRMemoryTracker* memoryTracker);
+
+		/// Destructor
+		~OVROcclusionCuller();
+
+		/// Set the objects to test.
+		/// With the same number of objects, the bounds are updated in place and the pending results are kept,
+		/// so moving objects can be set each frame. Otherwise the buffers are created again.
+		/// \param spheres World bounding spheres: center (x, y, z) and radius (w).
+		void SetBounds(const QVector<Vector4f>& spheres);
+
+		/// \return The number of objects.
+		int GetObjectCount() const;
+
+		/// Build the Hi-Z and test the objects for both eyes.
+		/// \param depthTexId Depth texture of the occluder view, 0 for frustum culling only.
+		/// \param occluderViewProj Projection * view matrix of the depth texture.
+		/// \param leftViewProj Projection * view matrix of the left eye.
+		/// \param rightViewProj Projection * view matrix of the right eye.
+		/// \param eyesDistance Distance between the eyes, margin of the occlusion test.
+		/// \note Called by the widget before rendering the eyes.
+		void Cull(GLuint depthTexId, const Matrix4f& occluderViewProj, const Matrix4f& leftViewProj, const Matrix4f& rightViewProj, float eyesDistance);
+
+		/// \return True if the object is in the eye frustum of the last Cull() and was not occluded in the last available results.
+		/// Only the occlusion part is one to three frames late. Objects without results yet are not occluded.
+		bool IsVisible(ovrEyeType eye, int object) const;
+
+		/// \return The CPU bitmask of the objects not occluded in the last available results
+		/// (bit object % 32 of word object / 32), empty without results. Test the frustum with the current matrices.
+		const QVector<quint32>& GetUnoccluded() const;
+
+		/// \return The shader storage buffer of the current frame bitmasks: left eye words, right eye words, then not occluded words.
+		GLuint GetVisibilityBuffer() const;
+
+	private:
+		/// Number of results read back in flight
+		enum { ReadbackSlots = OVR_MAX_FRAMES_IN_FLIGHT };
+
+		/// Results being read back
+		struct Readback
+		{
+			/// Fence signaled when the results are copied
+			GLsync fence;
+
+			/// Cull serial number of the results
+			qint64 serial;
+
+			/// Number of objects of the results
+			int objectCount;
+		};
+
+		/// Create the Hi-Z texture for a depth texture size.
+		void ResizeHiZ(int width, int height);
+
+		/// Copy the newest finished results to the CPU bitmasks.
+		void ReadResults();
+
+		/// Programs cache
+		OVRProgramCache* m_programCache;
+
+		/// Accounting of the Hi-Z texture and the buffers, may be nullptr
+		OVRMemoryTracker* m_memoryTracker;
+
+		/// Hi-Z build program
+		GLuint m_hiZProgram;
+
+		/// Cull program
+		GLuint m_cullProgram;
+
+		/// Hi-Z texture (R32F, farthest depth of each texel footprint)
+		GLuint m_hiZTexId;
+
+		/// Hi-Z level 0 width
+		int m_hiZWidth;
+
+		/// Hi-Z level 0 height
+		int m_hiZHeight;
+
+		/// Hi-Z mip levels
+		int m_hiZLevels;
+
+		/// Number of objects
+		int m_objectCount;
+
+		/// Number of 32 bits words of a bitmask
+		int m_wordCount;
+
+		/// Bounding spheres buffer
+		GLuint m_boundsBuffer;
+
+		/// Visibility bitmasks buffer
+		GLuint m_visibilityBuffer;
+
+		/// Persistently mapped readback buffer (one region per slot)
+		GLuint m_readbackBuffer;
+
+		/// Mapping of the readback buffer
+		const quint32* m_readbackData;
+
+		/// Readback slots
+		Readback m_readbacks[ReadbackSlots];
+
+		/// Number of Cull() calls
+		qint64 m_serial;
+
+		/// Serial number of the CPU bitmask
+		qint64 m_resultSerial;
+
+		/// CPU bitmask of the objects not occluded
+		QVector<quint32> m_unoccluded;
+
+		/// CPU copy of the bounding spheres
+		QVector<Vector4f> m_bounds;
+
+		/// Frustum planes of the left eye, then of the right eye, of the last Cull()
+		float m_planes[12][4];
+	};
+
+	/// \class OVRCameraRig
+	/// \brief Define a set of views (eyes, spectator, shadow cascades, reflections...) computed together.
+	/// A view is a tracking pose moved by a rig: translation, then roll * pitch * yaw rotations.
+	/// Inputs and matrices are stored component by component (structure of arrays) so that one
+	/// SSE or AVX pass computes several views at once. Views are recomputed by groups of 4 (SSE) or 8 (AVX):
+	/// a modified view recomputes the other views of its group.
+	class OVRCameraRig
+	{
+	public:
+		/// Comparison of the rig with the scalar computation
+		struct BenchmarkResult
+		{
+			/// Number of views
+			int viewCount;
+
+			/// Time of the scalar computation, in nanoseconds per view
+			double scalarTime;
+
+			/// Time of Update(), in nanoseconds per view
+			double batchedTime;
+
+			/// Largest difference between the matrices of both computations
+			float maxError;
+		};
+
+		/// Constructor
+		OVRCameraRig();
+
+		/// Add a view with an identity rig and pose.
+		/// \return The view index.
+		int AddView();
+
+		/// \return The number of views.
+		int GetViewCount() const;
+
+		/// Set the rig of a view.
+		/// \param view View index.
+		/// \param translation Rig translation.
+		/// \param rotations Rig angles: yaw, pitch, roll.
+		void SetRig(int view, const Vector3f& translation, const Vector3f& rotations);
+
+		/// Set the tracking pose of a view.
+		/// \param view View index.
+		/// \param orientation Orientation in the rig.
+		/// \param position Position in the rig.
+		void SetPose(int view, const Quatf& orientation, const Vector3f& position);
+
+		/// Set the projection of a view from a field of view, computed only when the field of view or the planes change.
+		/// \param view View index.
+		/// \param fov Field of view.
+		/// \param zNear Near plane distance.
+		/// \param zFar Far plane distance.
+		void SetFov(int view, const ovrFovPort& fov, float zNear, float zFar);
+
+		/// Set the projection of a view.
+		/// \param view View index.
+		/// \param projection Projection matrix.
+		void SetProjection(int view, const Matrix4f& projection);
+
+		/// Compute the matrices of the groups of 4 (SSE) or 8 (AVX) views which contain a modified view.
+		void Update();
+
+		/// \return The view matrix of a view, as given by Matrix4f::LookAtRH().
+		Matrix4f GetView(int view) const;
+
+		/// \return The projection matrix of a view.
+		Matrix4f GetProjection(int view) const;
+
+		/// \return The projection * view matrix of a view.
+		Matrix4f GetViewProjection(int view) const;
+
+		/// \return The world position of a view.
+		Vector3f GetPosition(int view) const;
+
+		/// Compare Update() with the scalar computation on random views, all modified at each iteration.
+		/// \param viewCount Number of views.
+		/// \param iterations Number of updates timed.
+		/// \return The time per view of both computations and their largest difference.
+		static BenchmarkResult Benchmark(int viewCount = 16, int iterations = 10000);
+
+	private:
+		/// Compute a view with the Matrix4f functions, as the widget did for each eye before the rig.
+		/// Reference of the batched computation.
+		static void ComputeScalar(const Vector3f& translation, const Vector3f& rotations, const Quatf& orientation, const Vector3f& position,
+			const ovrFovPort& fov, float zNear, float zFar, Matrix4f& view, Matrix4f& viewProjection);
+
+		/// Components of the views, each one stored in an array of m_capacity floats
+		enum Field {
+			TranslationX, TranslationY, TranslationZ,
+			CosYaw, SinYaw, CosPitch, SinPitch, CosRoll, SinRoll,
+			OrientationX, OrientationY, OrientationZ, OrientationW,
+			PoseX, PoseY, PoseZ,
+			/// Projection matrix, row major (16 fields)
+			Projection,
+			/// View matrix rows 0 to 2, row major (12 fields), row 3 is (0, 0, 0, 1)
+			View = Projection + 16,
+			/// Projection * view matrix, row major (16 fields)
+			ViewProjection = View + 12,
+			PositionX = ViewProjection + 16, PositionY, PositionZ,
+			FieldCount
+		};
+
+		/// \return The array of a component.
+		float* FieldData(int field);
+
+		/// \return The array of a component.
+		const float* FieldData(int field) const;
+
+		/// Compute the matrices of the views first to first + lane count.
+		void UpdateLanes(int first);
+
+		/// Components arrays, one after the other
+		QVector<float> m_fields;
+
+		/// Number of views
+		int m_count;
+
+		/// Length of the components arrays, multiple of the SIMD lane count
+		int m_capacity;
+
+		/// Field of view of a projection, to detect changes
+		struct Fov
+		{
+			/// Field of view
+			ovrFovPort port;
+
+			/// Near plane distance
+			float zNear;
+
+			/// Far plane distance
+			float zFar;
+
+			/// False when the projection was not set from this field of view
+			bool valid;
+		};
+
+		/// Rig angles of each view, to detect changes
+		QVector<Vector3f> m_rotations;
+
+		/// Field of view of each view, to detect changes
+		QVector<Fov> m_fovs;
+
+		/// Modification status of each view since the last update
+		QVector<bool> m_dirty;
+	};
+
+	/// Frames in flight statistics
+	struct FrameStatistics
+	{
+		/// Frames begun
+		qint64 frames;
+
+		/// Frames begun without waiting while the GPU was still running the previous frame (a synchronous frame would have waited)
+		qint64 stallsAvoided;
+
+		/// Frames which waited for the GPU
+		qint64 stalls;
+
+		/// Time spent waiting for the GPU, in milliseconds
+		double stallTime;
+	};
+
 private:
 
 	enum TargetRendering {
@@ -122,6 +862,15 @@ private:
 	/// Eyes rotation angles: yaw, pitch, roll
 	Vector3f m_eyesRotations;
 
+	/// Eyes rotation matrix: roll * pitch * yaw, updated when the angles change
+	Matrix4f m_eyesRollPitchYaw;
+
+	/// Eyes, spectator and client views
+	OVRCameraRig m_cameraRig;
+
+	/// Spectator view index in the camera rig
+	int m_spectatorRigView;
+
 	/// Timer
 	QTimer m_timer;
 
@@ -131,6 +880,77 @@ private:
 	/// Controllers activation
 	bool m_enableControllers;
 
+	/// Programs binaries cache
+	OVRProgramCache *m_programCache;
+
+	/// Duration of the last initializeGL() call, in milliseconds
+	double m_initializationTime;
+
+	// ////  Reprojection preview  ////
+
+	/// Widget preview mode
+	PreviewMode m_previewMode;
+
+	/// View matrices of the last headset frame
+	Matrix4f m_eyeViews[2];
+
+	/// Projection matrices of the last headset frame
+	Matrix4f m_eyeProjections[2];
+
+	/// Spectator camera set by the client
+	bool m_customSpectator;
+
+	/// Spectator view matrix
+	Matrix4f m_spectatorView;
+
+	/// Spectator projection matrix (custom spectator only)
+	Matrix4f m_spectatorProjection;
+
+	/// Reprojection programs of the solid quads and of the stretched quads
+	GLuint m_reprojectionPrograms[2];
+
+	/// Empty vertex array of the reprojection grid (vertices are built from gl_VertexID)
+	GLuint m_reprojectionVao;
+
+	// ////  Frames in flight  ////
+
+	/// Resources of a frame the GPU may still be processing
+	struct FrameContext
+	{
+		/// Fence signaled when the GPU has finished the frame
+		GLsync fence;
+
+		/// Allocator of the frame
+		OVRFrameAllocator allocator;
+	};
+
+	/// Number of frames in flight
+	int m_framesInFlight;
+
+	/// Size in bytes of each frame allocator
+	GLsizeiptr m_frameAllocatorSize;
+
+	/// Frames contexts
+	FrameContext m_frames[OVR_MAX_FRAMES_IN_FLIGHT];
+
+	/// Frame context of the current frame, nullptr outside of a frame
+	FrameContext* m_currentFrame;
+
+	/// Persistently mapped buffer shared by the frames allocators
+	GLuint m_frameBuffer;
+
+	/// Mapping of the frames buffer
+	char* m_frameBufferData;
+
+	/// Frames in flight statistics
+	FrameStatistics m_frameStatistics;
+
+	/// Occlusion culling of the client objects
+	OVROcclusionCuller *m_occlusionCuller;
+
+	/// GPU memory accounting
+	OVRMemoryTracker m_memoryTracker;
+
 #ifdef MIRRORING_WITH_FBO
 	// ////  Mirroring  ////
 
@@ -165,6 +985,28 @@ private:
 	void RenderMirroring();
 #endif
 
+	/// Build the reprojection program.
+	/// \note This function must be called in the initializeGL() function.
+	void InitializeReprojection();
+
+	/// Reproject the last eyes color and depth textures to the spectator camera.
+	/// \note This function must be called in the paintGL() function.
+	void RenderReprojection();
+
+	/// Create the frames buffer.
+	/// \note This function must be called in the initializeGL() function.
+	void InitializeFrames();
+
+	/// Wait until the GPU has finished the oldest frame in flight and reuse its context.
+	void BeginFrame();
+
+	/// Insert the fence of the current frame.
+	void EndFrame();
+
+	/// Release the objects of the context before it is destroyed, and reset their names.
+	/// \note Connected to QOpenGLContext::aboutToBeDestroyed, and called by the destructor.
+	Q_SLOT void ReleaseContext();
+
 public:
 
 	/// Construct the OVR OpenGL widget
@@ -185,8 +1027,14 @@ public:
 	virtual void InitializeRendering() = 0;
 
 	/// Method to update the scene (update animations for example)
-	/// \note Must be implemented. Called in paintGL() method.
-	virtual void UpdateRendering(ovrSessionStatus sessionStatus) = 0;
+	/// \note Implement this method or UpdateFrameRendering(...). Called in paintGL() method.
+	virtual void UpdateRendering(ovrSessionStatus sessionStatus);
+
+	/// Method to update the scene with per frame data (dynamic vertices, uniforms...)
+	/// \param sessionStatus The running Oculus session status
+	/// \param allocator Allocator of the current frame, released when the GPU has finished the frame.
+	/// \note Calls UpdateRendering(sessionStatus) by default. Called in paintGL() method.
+	virtual void UpdateFrameRendering(ovrSessionStatus sessionStatus, OVRFrameAllocator& allocator);
 
 	/// Method to render the scene.
 	/// \param sessionStatus The running Oculus session status
@@ -199,9 +1047,22 @@ public:
 	/// Send signal of controller state.
 	Q_SIGNAL void signalControllerState(ovrInputState i_controlState);
 
+	/// Send signal when an allocation brings the GPU memory usage close to the budget.
+	/// \param i_usage Total usage in bytes, including the allocation to come.
+	/// \param i_budget Budget in bytes.
+	/// \note Emitted before the memory is allocated: connect directly to evict caches in time.
+	Q_SIGNAL void signalMemoryBudgetWarning(qint64 i_usage, qint64 i_budget);
+
 	/// \return The running session.
 	ovrSession Session();
 
+	/// \return The programs binaries cache.
+	/// \note Available from InitializeRendering(). Pending compilations are finished after it.
+	OVRProgramCache* ProgramCache();
+
+	/// \return The duration of the last initializeGL() call (cold or warm cache), in milliseconds.
+	double GetInitializationTime() const;
+
 	/// \brief	Translate eyes positions by the vector (i_deltaX, i_deltaY, i_deltaZ).
 	/// \param	i_deltaX	Translation value on X axis.
 	/// \param	i_deltaY	Translation value on Y axis.
@@ -226,6 +1087,53 @@ public:
 	/// \return The eyes Euler's angles in vector (yaw, pitch, roll).
 	Vector3f GetRotations();
 
+	/// \brief Select how the scene is shown in the widget.
+	/// \param i_mode PreviewRender (default) or PreviewReprojection.
+	/// \note PreviewReprojection has a constant cost: it warps the last eyes textures with their depth.
+	void SetPreviewMode(PreviewMode i_mode);
+
+	/// \return The widget preview mode.
+	PreviewMode GetPreviewMode() const;
+
+	/// \brief Set the spectator camera of the reprojection preview.
+	/// \param i_view The view matrix.
+	/// \param i_projection The projection matrix.
+	void SetSpectatorCamera(const Matrix4f& i_view, const Matrix4f& i_projection);
+
+	/// \brief Reset the spectator camera: between the eyes, following the eyes rotations but not the head orientation.
+	void ResetSpectatorCamera();
+
+	/// \brief Set the number of frames the GPU may process while the CPU prepares the next one.
+	/// \param i_count 1 (synchronous) to OVR_MAX_FRAMES_IN_FLIGHT, 2 by default.
+	/// \param i_allocatorSize Size in bytes of each frame allocator.
+	/// \note Rebuilds the frames buffer once the widget is initialized; ignored during UpdateFrameRendering(...).
+	void SetFramesInFlight(int i_count, GLsizeiptr i_allocatorSize = OVR_FRAME_ALLOCATOR_SIZE);
+
+	/// \return The frames in flight statistics.
+	FrameStatistics GetFrameStatistics() const;
+
+	/// \return The occlusion culling of the client objects.
+	/// \note Available from InitializeRendering(). Culling runs each headset frame once bounds are set.
+	OVROcclusionCuller* OcclusionCuller();
+
+	/// \return The camera rig. Views 0 and 1 are the eyes and view 2 is the spectator: add your own views,
+	/// from index 3, to compute them in the same pass.
+	/// \note The rig is updated before the eyes rendering.
+	OVRCameraRig* CameraRig();
+
+	/// \return The GPU memory accounting of the widget. Reserve and track your own allocations in it.
+	OVRMemoryTracker* MemoryTracker();
+
+	/// \brief Set the GPU memory budget.
+	/// \param i_bytes Budget in bytes, 0 for no budget.
+	/// \param i_warningRatio Part of the budget above which signalMemoryBudgetWarning is emitted.
+	void SetMemoryBudget(qint64 i_bytes, double i_warningRatio = 0.9);
+
+	/// \return True if the object was visible by the eye in the last occlusion culling results.
+	/// \param eye The eye given to Render().
+	/// \param object Index of the object in the bounds given to the occlusion culling.
+	bool IsObjectVisible(ovrEyeType eye, int object) const;
+
 protected:
 
 	// From QOpenGLWidget...